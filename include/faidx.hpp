@@ -0,0 +1,636 @@
+//
+// Copyright (C) 2022 Armin Sobhani <arminms@gmail.com>
+//
+// The MIT License
+//
+
+#ifndef AMSTOOLS_FAIDX_HPP
+#define AMSTOOLS_FAIDX_HPP
+
+// Random access to the records of FastA/FastQ files through a samtools
+// compatible FILE.fai index and, for BGZF compressed files, a FILE.gzi index
+// of the BGZF blocks. Both are built next to FILE on first use (or kept in
+// memory if that is not possible) and rebuilt unless newer than FILE. 2bit
+// files are accessed through their own directory.
+//
+// Regions are given as NAME, NAME:BEG, NAME:BEG- or NAME:BEG-END with 1-based
+// inclusive coordinates, as with samtools faidx.
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <chrono>
+
+#include <sys/stat.h>
+
+#include <instream.hpp>
+#include <twobit.hpp>
+
+#if defined(_WIN32)
+#   define AMSTOOLS_FSEEK _fseeki64
+#else
+#   define AMSTOOLS_FSEEK fseeko
+#endif
+
+namespace amstools {
+
+// 0-based half-open range of record index
+struct region
+{
+    size_t index;
+    std::uint64_t begin, end;
+
+    std::uint64_t length() const
+    {   return end - begin;   }
+};
+
+// splits a comma separated list of regions
+inline std::vector<std::string> split_regions(const std::string& list)
+{
+    std::vector<std::string> specs;
+    size_t first = 0;
+    for (;;)
+    {
+        size_t last = list.find(',', first);
+        std::string spec = list.substr(first, last - first);
+        if (!spec.empty())
+            specs.push_back(spec);
+        if (std::string::npos == last)
+            return specs;
+        first = last + 1;
+    }
+}
+
+// reads one region per line
+inline std::vector<std::string> read_regions(const std::string& path)
+{
+    note_input(path);
+    std::FILE* fp = std::fopen(path.c_str(), "r");
+    if (nullptr == fp)
+        throw std::runtime_error("error reading " + path);
+    std::vector<std::string> specs;
+    std::string line;
+    int c;
+    while ((c = std::fgetc(fp)) != EOF)
+    {
+        if (c != '\n')
+        {
+            if (c != '\r')
+                line += char(c);
+            continue;
+        }
+        if (!line.empty())
+            specs.push_back(line);
+        line.clear();
+    }
+    if (!line.empty())
+        specs.push_back(line);
+    std::fclose(fp);
+    return specs;
+}
+
+class faidx
+{
+public:
+    struct entry
+    {
+        std::string name;
+        std::uint64_t length, offset, line_bases, line_width, qual_offset;
+    };
+
+    explicit faidx(const std::string& path)
+    :   path_(path)
+    ,   fp_(nullptr)
+    ,   bgzf_(false)
+    ,   fastq_(false)
+    ,   lookups_(0)
+    {
+        note_input(path);
+        fp_ = std::fopen(path.c_str(), "rb");
+        if (nullptr == fp_)
+            throw std::runtime_error("error reading " + path);
+        unsigned char head[18] = {};
+        size_t n = std::fread(head, 1, sizeof(head), fp_);
+        format f = sniff(head, n);
+        if (format::gzip == f)
+        {
+            // BGZF members carry their size in a 'BC' extra subfield
+            bgzf_ = n >= 16 && (head[3] & 4) && 'B' == head[12] && 'C' == head[13];
+            if (!bgzf_)
+                throw std::runtime_error
+                (   path + ": random access needs an uncompressed or BGZF "
+                    "compressed file (see bgzip)" );
+        }
+        else if (f != format::plain)
+            throw std::runtime_error
+            (   path + ": random access is not possible on "
+            +   format_name(f) + " compressed files" );
+        if (bgzf_ && (stale(path + ".gzi") || !load_gzi(path + ".gzi")))
+            build_gzi(path + ".gzi");
+        if (stale(path + ".fai") || !load_fai(path + ".fai"))
+            build_fai(path + ".fai");
+    }
+
+    ~faidx()
+    {
+        if (fp_)
+            std::fclose(fp_);
+    }
+
+    faidx(const faidx&) = delete;
+    faidx& operator= (const faidx&) = delete;
+
+    size_t size() const
+    {   return entries_.size();   }
+
+    const entry& operator[] (size_t i) const
+    {   return entries_[i];   }
+
+    bool fastq() const
+    {   return fastq_;   }
+
+    // index of the record named name, or size() if there is none; the first
+    // of duplicate names wins as with samtools
+    size_t find(const std::string& name) const
+    {
+        // hashing millions of read names costs more than a few linear scans
+        if (names_.empty() && ++lookups_ <= 16)
+        {
+            for (size_t i = 0; i < entries_.size(); ++i)
+                if (entries_[i].name == name)
+                    return i;
+            return size();
+        }
+        if (names_.empty())
+        {
+            names_.reserve(entries_.size());
+            for (size_t i = 0; i < entries_.size(); ++i)
+                names_.emplace(entries_[i].name, i);
+        }
+        auto it = names_.find(name);
+        return it == names_.end() ? size() : it->second;
+    }
+
+    // residues (and qualities of FastQ records if qual is not null) of r
+    void fetch(const region& r, std::string& seq, std::string* qual = nullptr)
+    {
+        const entry& e = entries_[r.index];
+        fetch(e, e.offset, r, seq);
+        if (qual)
+        {
+            if (fastq_)
+                fetch(e, e.qual_offset, r, *qual);
+            else
+                qual->clear();
+        }
+    }
+
+private:
+    // compressed and uncompressed offsets of a BGZF block
+    struct block
+    {
+        std::uint64_t coffset, uoffset;
+    };
+
+    std::string path_;
+    std::FILE* fp_;
+    bool bgzf_, fastq_;
+    std::vector<entry> entries_;
+    mutable std::unordered_map<std::string, size_t> names_;
+    mutable size_t lookups_;
+    std::vector<block> blocks_;
+
+    // true if index is missing or older than the indexed file
+    bool stale(const std::string& index) const
+    {
+        struct stat fs, is;
+        return stat(index.c_str(), &is) != 0
+        ||     stat(path_.c_str(), &fs) != 0
+        ||     is.st_mtime <= fs.st_mtime;
+    }
+
+    bool load_fai(const std::string& index)
+    {
+        std::FILE* fp = std::fopen(index.c_str(), "rb");
+        if (nullptr == fp)
+            return false;
+        std::string text;
+        char buf[1 << 16];
+        size_t n;
+        while ((n = std::fread(buf, 1, sizeof(buf), fp)) > 0)
+            text.append(buf, n);
+        std::fclose(fp);
+        entries_.clear();
+        entries_.reserve(std::count(text.begin(), text.end(), '\n'));
+        const char* p = text.c_str();
+        while (*p)
+        {
+            const char* tab = std::strchr(p, '\t');
+            if (nullptr == tab)
+                return false;
+            entry e{ std::string(p, tab), 0, 0, 0, 0, 0 };
+            std::uint64_t* v[] =
+            {   &e.length, &e.offset, &e.line_bases, &e.line_width, &e.qual_offset   };
+            int columns = 0;
+            for (p = tab; '\t' == *p && columns < 5; ++columns)
+            {
+                char* end;
+                *v[columns] = std::strtoull(p + 1, &end, 10);
+                if (end == p + 1)
+                    return false;
+                p = end;
+            }
+            if (columns < 4 || (*p && *p != '\n' && *p != '\r'))
+                return false;
+            fastq_ = 5 == columns;
+            entries_.push_back(e);
+            p += std::strspn(p, "\r\n");
+        }
+        return true;
+    }
+
+    void build_fai(const std::string& index)
+    {
+        entries_.clear();
+        std::unique_ptr<instream, int (*)(instream*)> in
+        (   in_open(path_)
+        ,   in_close
+        );
+        if (!in)
+            throw std::runtime_error("error reading " + path_);
+
+        // line based state machine over the uncompressed bytes
+        enum { none, sequence, quality } state = none;
+        entry e{};
+        bool last_line = false;     // a shorter line ended the residues
+        std::uint64_t qual_length = 0;
+        std::uint64_t pos = 0;      // offset of the current line
+        std::string line;
+        std::vector<char> buf(1 << 16);
+        auto residues = [&](std::uint64_t bases, std::uint64_t width)
+        {
+            if (0 == bases)
+            {
+                last_line = last_line || e.length > 0;
+                return;
+            }
+            if (last_line || (e.line_bases && bases > e.line_bases))
+                throw std::runtime_error
+                (   path_ + ": different line length in sequence '"
+                +   e.name + "'" );
+            if (0 == e.line_bases)
+            {
+                e.line_bases = bases;
+                e.line_width = width;
+            }
+            else if (bases < e.line_bases || width != e.line_width)
+                last_line = true;
+            e.length += bases;
+        };
+        auto process = [&](std::uint64_t width)
+        {
+            std::uint64_t bases = line.size();
+            if (bases && '\r' == line[bases - 1])
+                --bases;
+            if (quality == state)
+            {
+                qual_length += bases;
+                if (qual_length >= e.length)
+                    state = none;
+            }
+            else if ('>' == line[0] || ('@' == line[0] && none == state))
+            {
+                if (sequence == state && !fastq_)
+                    entries_.push_back(e);
+                fastq_ = '@' == line[0];
+                e = entry{};
+                e.name = line.substr(1, line.find_first_of(" \t\r") - 1);
+                e.offset = pos + width;
+                last_line = false;
+                state = sequence;
+            }
+            else if (sequence == state && fastq_ && '+' == line[0])
+            {
+                e.qual_offset = pos + width;
+                entries_.push_back(e);
+                qual_length = 0;
+                state = e.length ? quality : none;
+            }
+            else if (sequence == state)
+                residues(bases, width);
+        };
+        for (;;)
+        {
+            int n = in_read(in.get(), buf.data(), unsigned(buf.size()));
+            if (n < 0)
+                throw std::runtime_error("error reading " + path_);
+            if (0 == n)
+                break;
+            const char* p = buf.data();
+            const char* end = p + n;
+            while (p < end)
+            {
+                const char* nl = static_cast<const char*>
+                (   std::memchr(p, '\n', size_t(end - p))   );
+                if (nullptr == nl)
+                {
+                    line.append(p, end);
+                    break;
+                }
+                line.append(p, nl);
+                if (!line.empty() || state != none)
+                    process(line.size() + 1);
+                pos += line.size() + 1;
+                line.clear();
+                p = nl + 1;
+            }
+        }
+        if (!line.empty())
+            process(line.size());
+        if (sequence == state && !fastq_)
+            entries_.push_back(e);
+        else if (state != none)
+            throw std::runtime_error
+            (   path_ + ": truncated record '" + e.name + "'"   );
+
+        // keeping the index in memory if it cannot be written
+        std::string temp = temporary(index);
+        std::FILE* fp = std::fopen(temp.c_str(), "wb");
+        if (nullptr == fp)
+            return;
+        for (const auto& x : entries_)
+        {
+            std::fprintf
+            (   fp
+            ,   "%s\t%llu\t%llu\t%llu\t%llu"
+            ,   x.name.c_str()
+            ,   (unsigned long long)x.length
+            ,   (unsigned long long)x.offset
+            ,   (unsigned long long)x.line_bases
+            ,   (unsigned long long)x.line_width
+            );
+            if (fastq_)
+                std::fprintf(fp, "\t%llu", (unsigned long long)x.qual_offset);
+            std::fputc('\n', fp);
+        }
+        publish(fp, temp, index);
+    }
+
+    // indexes are written aside and renamed, so concurrent runs never read
+    // a partial one
+    static std::string temporary(const std::string& index)
+    {
+        return index + '.' + std::to_string
+        (   std::chrono::steady_clock::now().time_since_epoch().count()   );
+    }
+
+    static void publish
+    (   std::FILE* fp
+    ,   const std::string& temp
+    ,   const std::string& index
+    )
+    {
+        if (std::fclose(fp) || std::rename(temp.c_str(), index.c_str()))
+            std::remove(temp.c_str());
+    }
+
+    static std::uint64_t le(const unsigned char* p, int n)
+    {
+        std::uint64_t v = 0;
+        for (int i = n - 1; i >= 0; --i)
+            v = v << 8 | p[i];
+        return v;
+    }
+
+    // the .gzi lists the offsets of all blocks but the first
+    bool load_gzi(const std::string& index)
+    {
+        std::FILE* fp = std::fopen(index.c_str(), "rb");
+        if (nullptr == fp)
+            return false;
+        unsigned char b[16];
+        bool ok = std::fread(b, 8, 1, fp) == 1;
+        std::uint64_t n = ok ? le(b, 8) : 0;
+        blocks_.assign(1, block{ 0, 0 });
+        for (std::uint64_t i = 0; ok && i < n; ++i)
+        {
+            ok = std::fread(b, 16, 1, fp) == 1;
+            blocks_.push_back(block{ le(b, 8), le(b + 8, 8) });
+        }
+        std::fclose(fp);
+        return ok;
+    }
+
+    // walks the block headers, no decompression is needed
+    void build_gzi(const std::string& index)
+    {
+        blocks_.assign(1, block{ 0, 0 });
+        std::uint64_t coffset = 0, uoffset = 0;
+        unsigned char h[18], t[4];
+        for (;;)
+        {
+            if (AMSTOOLS_FSEEK(fp_, coffset, SEEK_SET) != 0)
+                throw std::runtime_error("error reading " + path_);
+            size_t n = std::fread(h, 1, sizeof(h), fp_);
+            if (0 == n)
+                break;
+            if (n < sizeof(h) || h[0] != 0x1F || h[1] != 0x8B
+            ||  !(h[3] & 4) || h[12] != 'B' || h[13] != 'C')
+                throw std::runtime_error(path_ + ": invalid BGZF block");
+            std::uint64_t size = le(h + 16, 2) + 1;
+            if (AMSTOOLS_FSEEK(fp_, coffset + size - 4, SEEK_SET) != 0
+            ||  std::fread(t, 4, 1, fp_) != 1)
+                throw std::runtime_error(path_ + ": truncated BGZF block");
+            coffset += size;
+            uoffset += le(t, 4);
+            blocks_.push_back(block{ coffset, uoffset });
+        }
+        blocks_.pop_back();     // the end of the file
+
+        std::string temp = temporary(index);
+        std::FILE* fp = std::fopen(temp.c_str(), "wb");
+        if (nullptr == fp)
+            return;
+        auto put = [&](std::uint64_t v)
+        {
+            unsigned char b[8];
+            for (int i = 0; i < 8; ++i)
+                b[i] = (unsigned char)(v >> (8 * i));
+            std::fwrite(b, 8, 1, fp);
+        };
+        put(blocks_.size() - 1);
+        for (size_t i = 1; i < blocks_.size(); ++i)
+        {
+            put(blocks_[i].coffset);
+            put(blocks_[i].uoffset);
+        }
+        publish(fp, temp, index);
+    }
+
+    // n uncompressed bytes at offset
+    void read(std::uint64_t offset, size_t n, std::string& out)
+    {
+        out.resize(n);
+        std::uint64_t coffset = offset, skip = 0;
+        if (bgzf_)
+        {
+            auto it = std::upper_bound
+            (   blocks_.begin()
+            ,   blocks_.end()
+            ,   offset
+            ,   [](std::uint64_t o, const block& b) { return o < b.uoffset; }
+            );
+            --it;
+            coffset = it->coffset;
+            skip = offset - it->uoffset;
+        }
+        if (AMSTOOLS_FSEEK(fp_, coffset, SEEK_SET) != 0)
+            throw std::runtime_error("error reading " + path_);
+        source src(fp_, false);
+        std::unique_ptr<decoder> dec
+        (   bgzf_
+        ?   static_cast<decoder*>(new gzip_decoder(src))
+        :   static_cast<decoder*>(new plain_decoder(src))
+        );
+        char scratch[1 << 14];
+        while (skip)
+        {
+            long got = dec->read(scratch, size_t(std::min<std::uint64_t>(skip, sizeof(scratch))));
+            if (got <= 0)
+                throw std::runtime_error("error reading " + path_);
+            skip -= std::uint64_t(got);
+        }
+        for (size_t done = 0; done < n; )
+        {
+            long got = dec->read(&out[done], n - done);
+            if (got <= 0)
+                throw std::runtime_error("error reading " + path_);
+            done += size_t(got);
+        }
+    }
+
+    // residues of r laid out as the record e from offset
+    void fetch
+    (   const entry& e
+    ,   std::uint64_t offset
+    ,   const region& r
+    ,   std::string& out
+    )
+    {
+        out.clear();
+        if (0 == r.length())
+            return;
+        auto at = [&](std::uint64_t i)
+        {   return offset + i / e.line_bases * e.line_width + i % e.line_bases;   };
+        const std::uint64_t first = at(r.begin), last = at(r.end - 1) + 1;
+        read(first, size_t(last - first), out);
+        // dropping the line breaks
+        out.erase
+        (   std::remove_if
+            (   out.begin()
+            ,   out.end()
+            ,   [](char c) { return '\n' == c || '\r' == c; }
+            )
+        ,   out.end()
+        );
+    }
+};
+
+// records of either a 2bit file or an indexed FastA/FastQ file
+class indexed_file
+{
+public:
+    explicit indexed_file(const std::string& path)
+    {
+        if (is_twobit(path))
+        {
+            twobit_.reset(new twobit_file(path));
+            for (size_t i = 0; i < twobit_->size(); ++i)
+                names_.emplace(twobit_->name(i), i);
+        }
+        else
+            faidx_.reset(new faidx(path));
+    }
+
+    // the range selected by a region spec, clipped to its record
+    region resolve(const std::string& spec) const
+    {
+        size_t i = find(spec);
+        std::uint64_t begin = 0, end = std::uint64_t(-1);
+        if (size() == i)
+        {
+            // NAME:BEG, NAME:BEG- or NAME:BEG-END unless NAME itself has a
+            // colon
+            size_t colon = spec.rfind(':');
+            if (std::string::npos == colon
+            ||  size() == (i = find(spec.substr(0, colon))) )
+                throw std::runtime_error
+                (   "sequence '" + spec + "' not found"   );
+            std::string range = spec.substr(colon + 1);
+            char* p = nullptr;
+            unsigned long long beg = std::strtoull(range.c_str(), &p, 10);
+            if ('-' == *p)
+            {
+                // NAME:BEG- runs to the end of the sequence
+                if (std::isdigit((unsigned char)p[1]))
+                    end = std::strtoull(p + 1, &p, 10);
+                else
+                    ++p;
+            }
+            if (*p || 0 == beg || end < beg)
+                throw std::runtime_error("invalid region '" + spec + "'");
+            begin = beg - 1;
+        }
+        const std::uint64_t n = length(i);
+        end = std::min(end, n);
+        begin = std::min(begin, end);
+        return region{ i, begin, end };
+    }
+
+    // name of the sequence r lies on
+    const std::string& name(const region& r) const
+    {   return twobit_ ? twobit_->name(r.index) : (*faidx_)[r.index].name;   }
+
+    // residues (and qualities of FastQ records if qual is not null) of r
+    void fetch(const region& r, std::string& seq, std::string* qual = nullptr)
+    {
+        if (faidx_)
+        {
+            faidx_->fetch(r, seq, qual);
+            return;
+        }
+        twobit_->sequence(r.index, r.begin, r.end, seq);
+        if (qual)
+            qual->clear();
+    }
+
+private:
+    std::unique_ptr<twobit_file> twobit_;
+    std::unique_ptr<faidx> faidx_;
+    std::unordered_map<std::string, size_t> names_;
+
+    size_t size() const
+    {   return twobit_ ? twobit_->size() : faidx_->size();   }
+
+    size_t find(const std::string& name) const
+    {
+        if (faidx_)
+            return faidx_->find(name);
+        auto it = names_.find(name);
+        return it == names_.end() ? size() : it->second;
+    }
+
+    std::uint64_t length(size_t i) const
+    {   return twobit_ ? twobit_->length(i) : (*faidx_)[i].length;   }
+};
+
+} // end amstools namespace
+
+#endif  // AMSTOOLS_FAIDX_HPP
@@ -0,0 +1,97 @@
+//
+// Copyright (C) 2022 Armin Sobhani <arminms@gmail.com>
+//
+// The MIT License
+//
+
+#ifndef AMSTOOLS_INPUTS_HPP
+#define AMSTOOLS_INPUTS_HPP
+
+// Bookkeeping of the files read by a request running inside the server (see
+// server.hpp). Everything that opens an input notes its path here, so cached
+// results can later be checked against the identity of the files they were
+// computed from. Inputs the server cannot provide (standard input, files that
+// are followed, progress on the client's terminal) make the request run on
+// the client instead. Outside the server all of this is a no-op.
+
+#include <string>
+#include <vector>
+#include <utility>
+
+#include <sys/stat.h>
+
+namespace amstools {
+
+// what changes whenever a file is replaced, written to or has its
+// permissions changed
+struct identity
+{
+    bool exists;
+    unsigned long long dev, ino, size;
+    long long mtime, mtime_ns, ctime, ctime_ns;
+
+    bool operator== (const identity& other) const
+    {
+        return exists == other.exists
+        &&  dev == other.dev
+        &&  ino == other.ino
+        &&  size == other.size
+        &&  mtime == other.mtime
+        &&  mtime_ns == other.mtime_ns
+        &&  ctime == other.ctime
+        &&  ctime_ns == other.ctime_ns;
+    }
+};
+
+inline identity identify(const std::string& path)
+{
+    identity id{};
+    struct stat st;
+    if (stat(path.c_str(), &st))
+        return id;
+    id.exists = true;
+    id.dev = st.st_dev;
+    id.ino = st.st_ino;
+    id.size = st.st_size;
+    id.mtime = st.st_mtime;
+    id.ctime = st.st_ctime;
+#if defined(__APPLE__)
+    id.mtime_ns = st.st_mtimespec.tv_nsec;
+    id.ctime_ns = st.st_ctimespec.tv_nsec;
+#elif !defined(_WIN32)
+    id.mtime_ns = st.st_mtim.tv_nsec;
+    id.ctime_ns = st.st_ctim.tv_nsec;
+#endif
+    return id;
+}
+
+typedef std::vector<std::pair<std::string, identity>> input_list;
+
+// inputs of the request run by this thread, null outside the server
+inline input_list*& current_inputs()
+{
+    static thread_local input_list* inputs = nullptr;
+    return inputs;
+}
+
+// called before opening path, so a file changing while it is read is seen as
+// changed by the next request
+inline void note_input(const std::string& path)
+{
+    if (auto inputs = current_inputs())
+        inputs->emplace_back(path, identify(path));
+}
+
+// thrown inside the server when a request needs the client itself; not an
+// std::exception so the tools' own error handling lets it through
+struct not_servable {};
+
+inline void require_client()
+{
+    if (current_inputs())
+        throw not_servable();
+}
+
+} // end amstools namespace
+
+#endif  // AMSTOOLS_INPUTS_HPP
@@ -0,0 +1,985 @@
+//
+// Copyright (C) 2022 Armin Sobhani <arminms@gmail.com>
+//
+// The MIT License
+//
+
+#ifndef AMSTOOLS_INSTREAM_HPP
+#define AMSTOOLS_INSTREAM_HPP
+
+// Input stream feeding kseq. The format is sniffed from the first bytes, so
+// plain, gzip (including BGZF), zstd, bzip2 and xz input all go through the
+// same interface; the last three when their libraries were found at configure
+// time. zstd files made of several frames are decoded in parallel.
+//
+// It can optionally follow a file that is still being written (e.g. by a
+// running sequencer): at end of file the read blocks until the file grows, so
+// the parser state and the partially read record are kept across EOF and only
+// new bytes are processed. It also publishes its input offset to an optional
+// progress meter and passes the decompressed bytes to an optional validator.
+//
+//   KSEQ_INIT(amstools::instream*, amstools::in_read)
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <future>
+#include <algorithm>
+#include <stdexcept>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+
+#include <zlib.h>
+#include <sys/stat.h>
+
+#if defined(AMSTOOLS_HAVE_ZSTD)
+#   include <zstd.h>
+#endif
+#if defined(AMSTOOLS_HAVE_BZIP2)
+#   include <bzlib.h>
+#endif
+#if defined(AMSTOOLS_HAVE_LZMA)
+#   include <lzma.h>
+#endif
+
+#include <progress.hpp>
+#include <inputs.hpp>
+#include <validate.hpp>
+
+#if defined(_WIN32)
+#   include <io.h>
+#   include <fcntl.h>
+#else
+#   include <sys/mman.h>
+#endif
+#if defined(__linux__)
+#   include <poll.h>
+#   include <unistd.h>
+#   include <sys/inotify.h>
+#endif
+
+namespace amstools {
+
+// set by SIGINT/SIGTERM while following to finish with the final statistics
+inline volatile std::sig_atomic_t& stop_requested()
+{
+    static volatile std::sig_atomic_t flag = 0;
+    return flag;
+}
+
+extern "C" inline void request_stop(int)
+{
+    stop_requested() = 1;
+}
+
+class follower
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    // report is called every interval seconds; following stops after timeout
+    // seconds without growth (0 means wait until interrupted)
+    follower
+    (   const std::string& path
+    ,   double interval
+    ,   double timeout
+    ,   std::function<void()> report
+    )
+    :   path_(path)
+    ,   interval_(interval)
+    ,   timeout_(timeout)
+    ,   report_(std::move(report))
+    ,   last_report_(clock::now())
+    ,   last_growth_(last_report_)
+    ,   fd_(-1)
+    {
+        std::signal(SIGINT, request_stop);
+        std::signal(SIGTERM, request_stop);
+#if defined(__linux__)
+        fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd_ >= 0 && inotify_add_watch(fd_, path.c_str(), IN_MODIFY) < 0)
+        {
+            close(fd_);
+            fd_ = -1;   // falling back to polling
+        }
+#endif
+    }
+
+    ~follower()
+    {
+#if defined(__linux__)
+        if (fd_ >= 0)
+            close(fd_);
+#endif
+    }
+
+    // reports if the interval has elapsed
+    void tick()
+    {
+        auto now = clock::now();
+        if (seconds(now - last_report_) >= interval_)
+        {
+            last_report_ = now;
+            if (report_)
+                report_();
+        }
+    }
+
+    // waits until the file grows beyond offset bytes; returns false if
+    // interrupted or timed out
+    bool wait(long long offset)
+    {
+        for (;;)
+        {
+            if (stop_requested())
+                return false;
+            auto now = clock::now();
+            if (size() > offset)
+            {
+                last_growth_ = now;
+                return true;
+            }
+            double idle = seconds(now - last_growth_);
+            if (timeout_ > 0 && idle >= timeout_)
+                return false;
+            double dt = interval_ - seconds(now - last_report_);
+            if (timeout_ > 0 && timeout_ - idle < dt)
+                dt = timeout_ - idle;
+            if (dt > 1.0)
+                dt = 1.0;   // bounds the latency of the polling fallback
+            if (dt < 0.0)
+                dt = 0.0;
+            int ms = int(dt * 1000) + 1;
+#if defined(__linux__)
+            if (fd_ >= 0)
+            {
+                struct pollfd pfd = { fd_, POLLIN, 0 };
+                if (poll(&pfd, 1, ms) > 0)
+                {
+                    char events[4096];
+                    while (read(fd_, events, sizeof(events)) > 0)
+                        ;
+                }
+            }
+            else
+#endif
+                std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+            tick();
+        }
+    }
+
+private:
+    std::string path_;
+    double interval_, timeout_;
+    std::function<void()> report_;
+    clock::time_point last_report_, last_growth_;
+    int fd_;
+
+    static double seconds(clock::duration d)
+    {   return std::chrono::duration<double>(d).count();   }
+
+    long long size() const
+    {
+        struct stat st;
+        return stat(path_.c_str(), &st) == 0 ? (long long)st.st_size : -1;
+    }
+};
+
+// compressed formats recognized by their magic bytes
+enum class format { plain, gzip, zstd, bzip2, xz };
+
+inline format sniff(const unsigned char* p, size_t n)
+{
+    if (n >= 2 && p[0] == 0x1F && p[1] == 0x8B)
+        return format::gzip;
+    // a zstd frame, or a skippable frame as written first by pzstd
+    if (n >= 4 && p[1] == 0xB5 && p[2] == 0x2F && p[3] == 0xFD && p[0] == 0x28)
+        return format::zstd;
+    if (n >= 4 && p[1] == 0x2A && p[2] == 0x4D && p[3] == 0x18
+    &&  (p[0] & 0xF0) == 0x50)
+        return format::zstd;
+    if (n >= 3 && p[0] == 'B' && p[1] == 'Z' && p[2] == 'h')
+        return format::bzip2;
+    if (n >= 6 && 0 == std::memcmp(p, "\xFD" "7zXZ\0", 6))
+        return format::xz;
+    return format::plain;
+}
+
+inline const char* format_name(format f)
+{
+    switch (f)
+    {
+        case format::gzip:  return "gzip";
+        case format::zstd:  return "zstd";
+        case format::bzip2: return "bzip2";
+        case format::xz:    return "xz";
+        default:            return "plain";
+    }
+}
+
+inline bool supported(format f)
+{
+    switch (f)
+    {
+#if !defined(AMSTOOLS_HAVE_ZSTD)
+        case format::zstd:  return false;
+#endif
+#if !defined(AMSTOOLS_HAVE_BZIP2)
+        case format::bzip2: return false;
+#endif
+#if !defined(AMSTOOLS_HAVE_LZMA)
+        case format::xz:    return false;
+#endif
+        default:            return true;
+    }
+}
+
+// raw bytes of a file or standard input; the bytes peeked for sniffing the
+// format are returned again by the following reads
+class source
+{
+public:
+    source(std::FILE* fp, bool owned)
+    :   fp_(fp)
+    ,   owned_(owned)
+    ,   pos_(0)
+    ,   offset_(0)
+    {}
+
+    ~source()
+    {
+        if (owned_)
+            std::fclose(fp_);
+    }
+
+    source(const source&) = delete;
+    source& operator= (const source&) = delete;
+
+    const std::string& peek(size_t n)
+    {
+        while (head_.size() < n)
+        {
+            char buf[16];
+            size_t got = std::fread(buf, 1, n - head_.size(), fp_);
+            if (0 == got)
+            {
+                std::clearerr(fp_);
+                break;
+            }
+            head_.append(buf, got);
+        }
+        return head_;
+    }
+
+    // returns the number of bytes read, 0 at the (current) end of file and
+    // -1 on error
+    long read(void* buf, size_t len)
+    {
+        size_t n = 0;
+        if (pos_ < head_.size())
+        {
+            n = std::min(len, head_.size() - pos_);
+            std::memcpy(buf, head_.data() + pos_, n);
+            pos_ += n;
+        }
+        if (n < len)
+        {
+            size_t got = std::fread(static_cast<char*>(buf) + n, 1, len - n, fp_);
+            if (got < len - n)
+            {
+                bool failed = std::ferror(fp_) != 0;
+                std::clearerr(fp_);     // the file may grow when following
+                if (failed && 0 == n + got)
+                    return -1;
+            }
+            n += got;
+        }
+        offset_ += n;
+        return long(n);
+    }
+
+    // bytes read from the file so far
+    long long offset() const
+    {   return offset_;   }
+
+    std::FILE* file() const
+    {   return fp_;   }
+
+private:
+    std::FILE* fp_;
+    bool owned_;
+    std::string head_;
+    size_t pos_;
+    long long offset_;
+};
+
+// decodes the bytes of a source; read returns the number of bytes decoded, 0
+// when the source has no more input for now and -1 on error
+class decoder
+{
+public:
+    explicit decoder(source& src)
+    :   src_(src)
+    {}
+
+    virtual ~decoder() {}
+
+    virtual long read(void* buf, size_t len) = 0;
+
+    // false while in the middle of a compressed stream, i.e. the input is
+    // truncated if the source has ended
+    virtual bool at_boundary() const
+    {   return true;   }
+
+    // input bytes consumed so far
+    virtual long long offset() const
+    {   return src_.offset();   }
+
+protected:
+    source& src_;
+};
+
+class plain_decoder : public decoder
+{
+public:
+    using decoder::decoder;
+
+    long read(void* buf, size_t len) override
+    {   return src_.read(buf, len);   }
+};
+
+// base of the streaming decoders, buffering their compressed input
+class buffered_decoder : public decoder
+{
+public:
+    explicit buffered_decoder(source& src)
+    :   decoder(src)
+    ,   in_(1 << 17)
+    {}
+
+protected:
+    std::vector<unsigned char> in_;
+
+    // fills in_ returning its number of bytes, 0 or -1 as source::read
+    long refill()
+    {   return src_.read(in_.data(), in_.size());   }
+};
+
+// concatenated gzip members (e.g. BGZF); trailing garbage is ignored as in
+// gzread
+class gzip_decoder : public buffered_decoder
+{
+public:
+    explicit gzip_decoder(source& src)
+    :   buffered_decoder(src)
+    ,   zs_()
+    ,   between_(true)
+    ,   garbage_(false)
+    {
+        if (inflateInit2(&zs_, 15 + 16) != Z_OK)
+            throw std::runtime_error("cannot initialize zlib");
+    }
+
+    ~gzip_decoder()
+    {   inflateEnd(&zs_);   }
+
+    long read(void* buf, size_t len) override
+    {
+        zs_.next_out = static_cast<Bytef*>(buf);
+        zs_.avail_out = unsigned(std::min<size_t>(len, 1U << 30));
+        unsigned avail = zs_.avail_out;
+        while (zs_.avail_out == avail && !garbage_)
+        {
+            if (0 == zs_.avail_in)
+            {
+                long n = refill();
+                if (n <= 0)
+                {
+                    if (n < 0)
+                        return -1;
+                    break;
+                }
+                zs_.next_in = in_.data();
+                zs_.avail_in = unsigned(n);
+            }
+            if (between_)
+            {
+                if (zs_.next_in[0] != 0x1F)
+                {
+                    garbage_ = true;
+                    break;
+                }
+                inflateReset(&zs_);
+                between_ = false;
+            }
+            int ret = inflate(&zs_, Z_NO_FLUSH);
+            if (Z_STREAM_END == ret)
+                between_ = true;
+            else if (ret != Z_OK && ret != Z_BUF_ERROR)
+                return -1;
+        }
+        return long(avail - zs_.avail_out);
+    }
+
+    bool at_boundary() const override
+    {   return between_ || garbage_;   }
+
+private:
+    z_stream zs_;
+    bool between_, garbage_;
+};
+
+#if defined(AMSTOOLS_HAVE_ZSTD)
+// streams frames one after another, skipping skippable frames
+class zstd_decoder : public buffered_decoder
+{
+public:
+    explicit zstd_decoder(source& src)
+    :   buffered_decoder(src)
+    ,   dctx_(ZSTD_createDCtx())
+    ,   in_buf_{ in_.data(), 0, 0 }
+    ,   boundary_(true)
+    ,   pending_(false)
+    {
+        if (nullptr == dctx_)
+            throw std::runtime_error("cannot initialize zstd");
+    }
+
+    ~zstd_decoder()
+    {   ZSTD_freeDCtx(dctx_);   }
+
+    long read(void* buf, size_t len) override
+    {
+        ZSTD_outBuffer out{ buf, len, 0 };
+        while (0 == out.pos)
+        {
+            // a full output buffer may leave decoded bytes to flush
+            if (in_buf_.pos == in_buf_.size && !pending_)
+            {
+                long n = refill();
+                if (n <= 0)
+                    return n;
+                in_buf_ = { in_.data(), size_t(n), 0 };
+            }
+            size_t ret = ZSTD_decompressStream(dctx_, &out, &in_buf_);
+            if (ZSTD_isError(ret))
+                return -1;
+            boundary_ = 0 == ret;
+            pending_ = out.pos == out.size;
+        }
+        return long(out.pos);
+    }
+
+    bool at_boundary() const override
+    {   return boundary_;   }
+
+private:
+    ZSTD_DCtx* dctx_;
+    ZSTD_inBuffer in_buf_;
+    bool boundary_, pending_;
+};
+
+#   if !defined(_WIN32)
+// Decodes a mapped zstd file. When it is made of several frames (pzstd,
+// seekable format, ...) up to one frame per hardware thread is decoded ahead
+// in parallel. Frames are located by walking their block headers in the
+// mapping, so no seek table is needed. Frames too big to be buffered are
+// streamed in order by the reading thread straight from the mapping.
+class zstd_frames_decoder : public decoder
+{
+public:
+    zstd_frames_decoder(source& src, size_t size)
+    :   decoder(src)
+    ,   data_(nullptr)
+    ,   size_(size)
+    ,   next_(0)
+    ,   consumed_(0)
+    ,   window_(std::max(1U, std::thread::hardware_concurrency()))
+    ,   pos_(0)
+    ,   dctx_(nullptr)
+    ,   stream_{ nullptr, 0, 0 }
+    ,   stream_start_(0)
+    ,   streaming_(false)
+    ,   blocked_(false)
+    {
+        void* p = mmap
+        (   nullptr
+        ,   size_
+        ,   PROT_READ
+        ,   MAP_PRIVATE
+        ,   fileno(src.file())
+        ,   0
+        );
+        if (MAP_FAILED == p)
+            throw std::runtime_error("error mapping zstd input");
+        madvise(p, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const unsigned char*>(p);
+    }
+
+    ~zstd_frames_decoder()
+    {
+        for (auto& f : ahead_)
+            if (f.data.valid())
+                f.data.wait();
+        ZSTD_freeDCtx(dctx_);
+        munmap(const_cast<unsigned char*>(data_), size_);
+    }
+
+    long read(void* buf, size_t len) override
+    {
+        for (;;)
+        {
+            if (pos_ < out_.size())
+            {
+                size_t n = std::min(len, out_.size() - pos_);
+                std::memcpy(buf, out_.data() + pos_, n);
+                pos_ += n;
+                return long(n);
+            }
+            if (streaming_)
+            {
+                ZSTD_outBuffer out{ buf, len, 0 };
+                size_t ret = ZSTD_decompressStream(dctx_, &out, &stream_);
+                if (ZSTD_isError(ret))
+                    return -1;
+                consumed_ = stream_start_ + stream_.pos;
+                if (0 == ret)
+                {
+                    streaming_ = blocked_ = false;
+                    next_ = consumed_;
+                    schedule();
+                }
+                if (out.pos)
+                    return long(out.pos);
+                if (streaming_ && stream_.pos == stream_.size)
+                    return -1;  // truncated
+                continue;
+            }
+            schedule();
+            if (ahead_.empty())
+                return 0;
+            frame f = std::move(ahead_.front());
+            ahead_.pop_front();
+            if (!f.data.valid())
+            {
+                if (nullptr == dctx_ && nullptr == (dctx_ = ZSTD_createDCtx()))
+                    return -1;
+                ZSTD_DCtx_reset(dctx_, ZSTD_reset_session_only);
+                stream_start_ = f.start;
+                stream_ = { data_ + f.start, size_ - f.start, 0 };
+                streaming_ = true;
+                continue;
+            }
+            try
+            {
+                spare_.push_back(std::move(out_));
+                out_ = f.data.get();
+            }
+            catch (std::exception&)
+            {
+                return -1;
+            }
+            pos_ = 0;
+            consumed_ = f.end;
+        }
+    }
+
+    bool at_boundary() const override
+    {   return !streaming_;   }
+
+    long long offset() const override
+    {   return (long long)consumed_;   }
+
+private:
+    // the largest frame decoded ahead, for bounding memory use
+    static constexpr size_t max_frame = size_t(1) << 26;
+
+    struct frame
+    {
+        size_t start, end;
+        std::future<std::string> data;  // invalid if streamed
+    };
+
+    const unsigned char* data_;
+    size_t size_, next_, consumed_;
+    unsigned window_;
+    std::deque<frame> ahead_;
+    std::string out_;
+    std::vector<std::string> spare_;    // buffers of consumed frames
+    size_t pos_;
+    ZSTD_DCtx* dctx_;
+    ZSTD_inBuffer stream_;
+    size_t stream_start_;
+    bool streaming_, blocked_;
+
+    void schedule()
+    {
+        while (!blocked_ && next_ < size_ && ahead_.size() < window_)
+        {
+            const unsigned char* p = data_ + next_;
+            size_t avail = size_ - next_;
+            size_t n = ZSTD_findFrameCompressedSize
+            (   p
+            ,   std::min(avail, max_frame)
+            );
+            unsigned long long content = ZSTD_getFrameContentSize(p, avail);
+            if (ZSTD_isError(n)
+            ||  (   content != ZSTD_CONTENTSIZE_UNKNOWN
+                &&  content > max_frame ) )
+            {
+                // its end is only known after streaming it
+                ahead_.push_back(frame{ next_, 0, {} });
+                blocked_ = true;
+                break;
+            }
+            std::string buf;
+            if (!spare_.empty())
+            {
+                buf = std::move(spare_.back());
+                spare_.pop_back();
+            }
+            ahead_.push_back(frame
+            {   next_
+            ,   next_ + n
+            ,   std::async
+                (   std::launch::async
+                ,   decode
+                ,   p
+                ,   n
+                ,   content
+                ,   std::move(buf)
+                )
+            });
+            next_ += n;
+        }
+    }
+
+    static std::string decode
+    (   const unsigned char* p
+    ,   size_t n
+    ,   unsigned long long content
+    ,   std::string out     // reused buffer
+    )
+    {
+        std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)>
+            dctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+        if (!dctx)
+            throw std::runtime_error("cannot initialize zstd");
+        if (content != ZSTD_CONTENTSIZE_UNKNOWN)
+        {
+            out.resize(size_t(content));
+            size_t ret = ZSTD_decompressDCtx
+            (   dctx.get()
+            ,   &out[0]
+            ,   out.size()
+            ,   p
+            ,   n
+            );
+            if (ZSTD_isError(ret) || ret != out.size())
+                throw std::runtime_error("corrupted zstd frame");
+            return out;
+        }
+        out.clear();
+        ZSTD_inBuffer in{ p, n, 0 };
+        size_t ret = 1;
+        while (ret != 0)
+        {
+            size_t used = out.size();
+            out.resize(used + ZSTD_DStreamOutSize());
+            ZSTD_outBuffer o{ &out[0] + used, out.size() - used, 0 };
+            ret = ZSTD_decompressStream(dctx.get(), &o, &in);
+            out.resize(used + o.pos);
+            if (ZSTD_isError(ret) || (in.pos == in.size && 0 == o.pos && ret))
+                throw std::runtime_error("corrupted zstd frame");
+        }
+        return out;
+    }
+};
+#   endif
+#endif  // AMSTOOLS_HAVE_ZSTD
+
+#if defined(AMSTOOLS_HAVE_BZIP2)
+// concatenated bzip2 streams (e.g. pbzip2)
+class bzip2_decoder : public buffered_decoder
+{
+public:
+    explicit bzip2_decoder(source& src)
+    :   buffered_decoder(src)
+    ,   bz_()
+    ,   active_(false)
+    ,   garbage_(false)
+    ,   pending_(false)
+    {}
+
+    ~bzip2_decoder()
+    {
+        if (active_)
+            BZ2_bzDecompressEnd(&bz_);
+    }
+
+    long read(void* buf, size_t len) override
+    {
+        bz_.next_out = static_cast<char*>(buf);
+        bz_.avail_out = unsigned(std::min<size_t>(len, 1U << 30));
+        unsigned avail = bz_.avail_out;
+        while (bz_.avail_out == avail && !garbage_)
+        {
+            if (0 == bz_.avail_in && !pending_)
+            {
+                long n = refill();
+                if (n <= 0)
+                {
+                    if (n < 0)
+                        return -1;
+                    break;
+                }
+                bz_.next_in = reinterpret_cast<char*>(in_.data());
+                bz_.avail_in = unsigned(n);
+            }
+            if (!active_)
+            {
+                if (bz_.next_in[0] != 'B')
+                {
+                    garbage_ = true;
+                    break;
+                }
+                if (BZ2_bzDecompressInit(&bz_, 0, 0) != BZ_OK)
+                    return -1;
+                active_ = true;
+            }
+            int ret = BZ2_bzDecompress(&bz_);
+            pending_ = 0 == bz_.avail_out;
+            if (BZ_STREAM_END == ret)
+            {
+                BZ2_bzDecompressEnd(&bz_);
+                active_ = pending_ = false;
+            }
+            else if (ret != BZ_OK)
+                return -1;
+        }
+        return long(avail - bz_.avail_out);
+    }
+
+    bool at_boundary() const override
+    {   return !active_;   }
+
+private:
+    bz_stream bz_;
+    bool active_, garbage_, pending_;
+};
+#endif  // AMSTOOLS_HAVE_BZIP2
+
+#if defined(AMSTOOLS_HAVE_LZMA)
+// concatenated xz streams, possibly separated by stream padding
+class xz_decoder : public buffered_decoder
+{
+public:
+    explicit xz_decoder(source& src)
+    :   buffered_decoder(src)
+    ,   strm_(LZMA_STREAM_INIT)
+    ,   active_(false)
+    ,   garbage_(false)
+    ,   pending_(false)
+    {}
+
+    ~xz_decoder()
+    {   lzma_end(&strm_);   }
+
+    long read(void* buf, size_t len) override
+    {
+        strm_.next_out = static_cast<uint8_t*>(buf);
+        strm_.avail_out = len;
+        while (strm_.avail_out == len && !garbage_)
+        {
+            // xz may keep decoded bytes when the output buffer is full
+            if (0 == strm_.avail_in && !pending_)
+            {
+                long n = refill();
+                if (n <= 0)
+                {
+                    if (n < 0)
+                        return -1;
+                    break;
+                }
+                strm_.next_in = in_.data();
+                strm_.avail_in = size_t(n);
+            }
+            if (!active_)
+            {
+                if (0 == strm_.next_in[0])
+                {
+                    ++strm_.next_in;    // stream padding
+                    --strm_.avail_in;
+                    continue;
+                }
+                if (strm_.next_in[0] != 0xFD)
+                {
+                    garbage_ = true;
+                    break;
+                }
+                if (lzma_stream_decoder(&strm_, UINT64_MAX, 0) != LZMA_OK)
+                    return -1;
+                active_ = true;
+            }
+            lzma_ret ret = lzma_code(&strm_, LZMA_RUN);
+            pending_ = 0 == strm_.avail_out;
+            if (LZMA_STREAM_END == ret)
+                active_ = pending_ = false;
+            else if (ret != LZMA_OK && ret != LZMA_BUF_ERROR)
+                return -1;
+        }
+        return long(len - strm_.avail_out);
+    }
+
+    bool at_boundary() const override
+    {   return !active_;   }
+
+private:
+    lzma_stream strm_;
+    bool active_, garbage_, pending_;
+};
+#endif  // AMSTOOLS_HAVE_LZMA
+
+struct instream
+{
+    std::string name;
+    source src;
+    format fmt;
+    std::unique_ptr<decoder> dec;   // made on the first read
+    std::unique_ptr<follower> follow;
+    progress* meter;    // optional, receives the input offsets
+    validator* check;   // optional, checks the decompressed bytes
+
+    instream(const std::string& file, std::FILE* fp, bool owned)
+    :   name(file)
+    ,   src(fp, owned)
+    ,   fmt(format::plain)
+    ,   meter(nullptr)
+    ,   check(nullptr)
+    {}
+};
+
+// sniffs the format of in, throwing if it is not supported by this build
+inline void in_sniff(instream* in)
+{
+    const std::string& head = in->src.peek(6);
+    in->fmt = sniff
+    (   reinterpret_cast<const unsigned char*>(head.data())
+    ,   head.size()
+    );
+    if (!supported(in->fmt))
+        throw std::runtime_error
+        (   in->name + ": " + format_name(in->fmt)
+        +   " input is not supported by this build" );
+}
+
+// opens file for reading, or standard input if file is "-"; returns nullptr
+// on failure and throws if the file is compressed in a format not supported
+// by this build
+inline instream* in_open(const std::string& file)
+{
+    if (file == "-")
+        require_client();
+    else
+        note_input(file);
+    std::FILE* fp = file == "-" ? stdin : std::fopen(file.c_str(), "rb");
+    if (nullptr == fp)
+        return nullptr;
+#if defined(_WIN32)
+    if (stdin == fp)
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    std::setvbuf(fp, nullptr, _IONBF, 0);   // reads go straight to buf
+    std::unique_ptr<instream> in(new instream(file, fp, stdin != fp));
+    in_sniff(in.get());
+    return in.release();
+}
+
+inline std::unique_ptr<decoder> make_decoder(instream* in)
+{
+    switch (in->fmt)
+    {
+        case format::gzip:
+            return std::unique_ptr<decoder>(new gzip_decoder(in->src));
+#if defined(AMSTOOLS_HAVE_ZSTD)
+        case format::zstd:
+        {
+#   if !defined(_WIN32)
+            // growing files and pipes are streamed
+            struct stat st;
+            if (!in->follow
+            &&  fstat(fileno(in->src.file()), &st) == 0
+            &&  S_ISREG(st.st_mode)
+            &&  st.st_size > 0)
+                return std::unique_ptr<decoder>
+                (   new zstd_frames_decoder(in->src, size_t(st.st_size))   );
+#   endif
+            return std::unique_ptr<decoder>(new zstd_decoder(in->src));
+        }
+#endif
+#if defined(AMSTOOLS_HAVE_BZIP2)
+        case format::bzip2:
+            return std::unique_ptr<decoder>(new bzip2_decoder(in->src));
+#endif
+#if defined(AMSTOOLS_HAVE_LZMA)
+        case format::xz:
+            return std::unique_ptr<decoder>(new xz_decoder(in->src));
+#endif
+        default:
+            return std::unique_ptr<decoder>(new plain_decoder(in->src));
+    }
+}
+
+inline int in_read(instream* in, void* buf, unsigned len)
+{
+    if (!in->dec)
+    {
+        // a followed file may still be too short to tell its format
+        if (in->follow)
+        {
+            while
+            (   in->src.peek(6).size() < 6
+            &&  in->follow->wait((long long)in->src.peek(6).size())
+            )
+                ;
+            in_sniff(in);
+        }
+        in->dec = make_decoder(in);
+    }
+    for (;;)
+    {
+        long n = in->dec->read(buf, len);
+        if (in->meter && in->meter->due())
+            in->meter->sample(in->dec->offset());
+        if (in->check)
+        {
+            if (n > 0)
+                in->check->feed(static_cast<const char*>(buf), size_t(n));
+            else if (n < 0 || (!in->follow && !in->dec->at_boundary()))
+                in->check->corrupt();
+        }
+        if (!in->follow)
+            return n < 0 || (0 == n && !in->dec->at_boundary()) ? -1 : int(n);
+        in->follow->tick();
+        if (n != 0)
+            return n < 0 ? -1 : int(n);
+        // the file may end in the middle of a compressed stream while written
+        if (!in->follow->wait(in->src.offset()))
+            return 0;
+    }
+}
+
+inline int in_close(instream* in)
+{
+    delete in;
+    return 0;
+}
+
+} // end amstools namespace
+
+#endif  // AMSTOOLS_INSTREAM_HPP
@@ -0,0 +1,194 @@
+//
+// Copyright (C) 2022 Armin Sobhani <arminms@gmail.com>
+//
+// The MIT License
+//
+
+#ifndef AMSTOOLS_PROGRESS_HPP
+#define AMSTOOLS_PROGRESS_HPP
+
+// Progress reporting of long runs over a list of files. A timer thread prints
+// bytes processed, MB/s, records/s and ETA to standard error. Positions are
+// compressed input offsets summed across the files, so ETA is based on their
+// sizes on disk. The reading thread only publishes its position when the
+// timer asks for it, once per buffer refill, so parsing records costs nothing
+// extra.
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <cstdio>
+
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#   include <io.h>
+#   define AMSTOOLS_ISATTY _isatty
+#   define AMSTOOLS_FILENO _fileno
+#else
+#   include <unistd.h>
+#   define AMSTOOLS_ISATTY isatty
+#   define AMSTOOLS_FILENO fileno
+#endif
+
+namespace amstools {
+
+class progress
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    progress
+    (   const std::string& program
+    ,   const std::vector<std::string>& files
+    ,   double interval = 1.0
+    )
+    :   program_(program)
+    ,   interval_(interval)
+    ,   total_(0)
+    ,   done_bytes_(0)
+    ,   done_records_(0)
+    ,   file_(0)
+    ,   offset_(0)
+    ,   records_(0)
+    ,   due_(false)
+    ,   stop_(false)
+    ,   tty_(AMSTOOLS_ISATTY(AMSTOOLS_FILENO(stderr)) != 0)
+    ,   start_(clock::now())
+    {
+        for (const auto& file : files)
+        {
+            struct stat st;
+            long long size = file != "-" && stat(file.c_str(), &st) == 0
+            ?   (long long)st.st_size
+            :   0;
+            sizes_.push_back(size);
+            total_ += size;
+        }
+        timer_ = std::thread(&progress::run, this);
+    }
+
+    ~progress()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        timer_.join();
+        report(true);
+    }
+
+    progress(const progress&) = delete;
+    progress& operator= (const progress&) = delete;
+
+    // called by the reading thread before reading the i-th file; records
+    // returns the number of records read from it so far
+    void start_file(size_t i, std::function<size_t()> records)
+    {
+        file_.store(i, std::memory_order_relaxed);
+        offset_.store(0, std::memory_order_relaxed);
+        records_.store(0, std::memory_order_relaxed);
+        count_ = std::move(records);
+    }
+
+    // called by the reading thread after reading the current file
+    void finish_file(size_t records)
+    {
+        size_t i = file_.load(std::memory_order_relaxed);
+        done_bytes_.fetch_add(i < sizes_.size() ? sizes_[i] : 0);
+        done_records_.fetch_add(records);
+        offset_.store(0, std::memory_order_relaxed);
+        records_.store(0, std::memory_order_relaxed);
+        count_ = nullptr;
+    }
+
+    // true when the timer wants a new sample
+    bool due() const
+    {   return due_.load(std::memory_order_relaxed);   }
+
+    // publishes the compressed offset within the current file
+    void sample(long long offset)
+    {
+        due_.store(false, std::memory_order_relaxed);
+        offset_.store(offset, std::memory_order_relaxed);
+        if (count_)
+            records_.store(count_(), std::memory_order_relaxed);
+    }
+
+private:
+    std::string program_;
+    double interval_;
+    std::vector<long long> sizes_;
+    long long total_;
+    std::atomic<long long> done_bytes_;
+    std::atomic<size_t> done_records_;
+    std::atomic<size_t> file_;
+    std::atomic<long long> offset_;
+    std::atomic<size_t> records_;
+    std::atomic<bool> due_;
+    bool stop_;
+    bool tty_;
+    clock::time_point start_;
+    std::function<size_t()> count_;
+    std::thread timer_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!cv_.wait_for
+        (   lock
+        ,   std::chrono::duration<double>(interval_)
+        ,   [this] { return stop_; } ))
+        {
+            report(false);
+            due_.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    void report(bool last)
+    {
+        double elapsed
+        =   std::chrono::duration<double>(clock::now() - start_).count();
+        double bytes = double(done_bytes_.load() + offset_.load());
+        double records = double(done_records_.load() + records_.load());
+        double rate = elapsed > 0.0 ? bytes / elapsed : 0.0;
+        char eta[32] = "--:--:--";
+        if (total_ > 0 && rate > 0.0 && bytes <= double(total_))
+        {
+            long long s = (long long)((double(total_) - bytes) / rate);
+            std::snprintf
+            (   eta
+            ,   sizeof(eta)
+            ,   "%02lld:%02lld:%02lld"
+            ,   s / 3600
+            ,   s / 60 % 60
+            ,   s % 60
+            );
+        }
+        std::fprintf
+        (   stderr
+        ,   "%s%s: %.1f/%.1f MB  %.1f MB/s  %.0f records/s  ETA %s%s"
+        ,   tty_ ? "\r" : ""
+        ,   program_.c_str()
+        ,   bytes / 1e6
+        ,   double(total_) / 1e6
+        ,   rate / 1e6
+        ,   elapsed > 0.0 ? records / elapsed : 0.0
+        ,   last ? "00:00:00" : eta
+        ,   tty_ && !last ? "" : "\n"
+        );
+        std::fflush(stderr);
+    }
+};
+
+} // end amstools namespace
+
+#endif  // AMSTOOLS_PROGRESS_HPP
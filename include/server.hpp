@@ -0,0 +1,559 @@
+//
+// Copyright (C) 2022 Armin Sobhani <arminms@gmail.com>
+//
+// The MIT License
+//
+
+#ifndef AMSTOOLS_SERVER_HPP
+#define AMSTOOLS_SERVER_HPP
+
+// Resident server mode of the statistics tools. Workflows that start a tool
+// thousands of times on small files pay the process startup, and often parse
+// the very same files again, on every call. With --serve SOCK the tool stays
+// resident and answers requests arriving on the Unix domain socket SOCK from
+// a pool of worker threads; with --connect SOCK it only forwards its
+// arguments and working directory there and prints the reply, so the output
+// and exit status are those of a standalone run.
+//
+// Replies are kept in an LRU cache keyed on the working directory and the
+// arguments, and reused only while every file read by the request still has
+// the same identity (device, inode, size, modification and change times, see
+// inputs.hpp). Requests the server cannot answer alike, e.g. ones reading the
+// client's standard input, are run by the client itself.
+//
+//   int run(int argc, char* argv[], std::ostream& out, std::ostream& err);
+//
+//   int main(int argc, char* argv[])
+//   {   return amstools::dispatch("sc", argc, argv, run);   }
+
+#include <string>
+#include <vector>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <sstream>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <instream.hpp>
+#include <inputs.hpp>
+
+#if !defined(_WIN32)
+#   include <poll.h>
+#   include <unistd.h>
+#   include <sys/socket.h>
+#   include <sys/stat.h>
+#   include <sys/un.h>
+#endif
+#if defined(__linux__)
+#   include <sched.h>
+#endif
+
+namespace amstools {
+
+// the body of a tool, writing to out and err instead of the standard streams
+typedef int (*tool)(int argc, char* argv[], std::ostream& out, std::ostream& err);
+
+struct server_reply
+{
+    int status;
+    std::string out, err;
+};
+
+#if !defined(_WIN32)
+
+// wire format, both ways in host byte order as both ends share the host:
+//
+//   request : count (uint32), count x { size (uint64), bytes }
+//             program, working directory, then the arguments
+//   reply   : kind (uint8), status (int32), out and err as { size, bytes }
+//             kind is 0 when answered and 1 when the client runs it itself
+
+const std::uint64_t server_max_string = 1ULL << 30;
+const std::uint32_t server_max_strings = 1U << 20;
+
+inline bool write_all(int fd, const void* data, size_t size)
+{
+#if defined(MSG_NOSIGNAL)
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+    auto p = static_cast<const char*>(data);
+    while (size)
+    {
+        ssize_t n = send(fd, p, size, flags);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+inline bool read_all(int fd, void* data, size_t size)
+{
+    auto p = static_cast<char*>(data);
+    while (size)
+    {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+inline bool write_string(int fd, const std::string& s)
+{
+    std::uint64_t size = s.size();
+    return write_all(fd, &size, sizeof(size))
+    &&     write_all(fd, s.data(), s.size());
+}
+
+inline bool read_string(int fd, std::string& s)
+{
+    std::uint64_t size;
+    if (!read_all(fd, &size, sizeof(size)) || size > server_max_string)
+        return false;
+    s.resize(size);
+    return read_all(fd, &s[0], size);
+}
+
+inline bool write_reply(int fd, std::uint8_t kind, const server_reply& reply)
+{
+    std::int32_t status = reply.status;
+    return write_all(fd, &kind, sizeof(kind))
+    &&     write_all(fd, &status, sizeof(status))
+    &&     write_string(fd, reply.out)
+    &&     write_string(fd, reply.err);
+}
+
+inline sockaddr_un socket_address(const std::string& path)
+{
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("invalid socket path " + path);
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+    return addr;
+}
+
+inline int socket_stream()
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw std::runtime_error(std::strerror(errno));
+#if defined(SO_NOSIGPIPE)
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    return fd;
+}
+
+// replies by key, evicting the least recently used beyond budget bytes
+class result_cache
+{
+public:
+    explicit result_cache(size_t budget)
+    :   budget_(budget)
+    ,   bytes_(0)
+    {}
+
+    bool find(const std::string& key, server_reply& reply, input_list& inputs)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(key);
+        if (it == index_.end())
+            return false;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        reply = it->second->reply;
+        inputs = it->second->inputs;
+        return true;
+    }
+
+    void insert
+    (   const std::string& key
+    ,   const server_reply& reply
+    ,   const input_list& inputs
+    )
+    {
+        size_t bytes = key.size() + reply.out.size() + reply.err.size();
+        for (const auto& input : inputs)
+            bytes += input.first.size() + sizeof(input.second);
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(key);
+        if (it != index_.end())
+            erase(it->second);
+        if (bytes > budget_)
+            return;
+        lru_.push_front(entry{ key, reply, inputs, bytes });
+        index_[key] = lru_.begin();
+        bytes_ += bytes;
+        while (bytes_ > budget_)
+            erase(std::prev(lru_.end()));
+    }
+
+private:
+    struct entry
+    {
+        std::string key;
+        server_reply reply;
+        input_list inputs;
+        size_t bytes;
+    };
+
+    size_t budget_, bytes_;
+    std::list<entry> lru_;
+    std::unordered_map<std::string, std::list<entry>::iterator> index_;
+    std::mutex mutex_;
+
+    void erase(std::list<entry>::iterator it)
+    {
+        bytes_ -= it->bytes;
+        index_.erase(it->key);
+        lru_.erase(it);
+    }
+};
+
+class server
+{
+public:
+    server
+    (   const std::string& program
+    ,   tool run
+    ,   const std::string& path
+    ,   unsigned threads = std::max(1U, std::thread::hardware_concurrency())
+    ,   size_t cache = size_t(64) << 20
+    )
+    :   program_(program)
+    ,   run_(run)
+    ,   path_(path)
+    ,   fd_(-1)
+    ,   cache_(cache)
+    ,   stop_(false)
+    {
+        sockaddr_un addr = socket_address(path);
+        {
+            // a socket left behind by a server that is gone is replaced
+            int probe = socket_stream();
+            bool alive = connect(probe, (sockaddr*)&addr, sizeof(addr)) == 0;
+            close(probe);
+            if (alive)
+                throw std::runtime_error(path + " is already being served");
+        }
+
+        // the socket is bound under a temporary name and only renamed to
+        // path once listening, so clients finding it are never refused
+        std::string temp = path + '.' + std::to_string(getpid());
+        sockaddr_un temp_addr = socket_address(temp);
+        fd_ = socket_stream();
+        unlink(temp.c_str());
+        if (!bind_socket(temp_addr)
+        ||  listen(fd_, SOMAXCONN)
+        ||  rename(temp.c_str(), path.c_str()))
+        {
+            close(fd_);
+            unlink(temp.c_str());
+            throw std::runtime_error("cannot listen on " + path);
+        }
+        for (unsigned i = 0; i < threads; ++i)
+            workers_.emplace_back(&server::work, this);
+    }
+
+    ~server()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto& worker : workers_)
+            worker.join();
+        for (int fd : queue_)
+            close(fd);
+        close(fd_);
+        unlink(path_.c_str());
+    }
+
+    server(const server&) = delete;
+    server& operator= (const server&) = delete;
+
+    // accepts connections until SIGINT or SIGTERM
+    void loop()
+    {
+        std::signal(SIGINT, request_stop);
+        std::signal(SIGTERM, request_stop);
+        std::signal(SIGPIPE, SIG_IGN);
+        while (!stop_requested())
+        {
+            pollfd p{ fd_, POLLIN, 0 };
+            if (poll(&p, 1, 500) <= 0)
+                continue;
+            int fd = accept(fd_, nullptr, nullptr);
+            if (fd < 0)
+                continue;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                queue_.push_back(fd);
+            }
+            cv_.notify_one();
+        }
+    }
+
+private:
+    std::string program_;
+    tool run_;
+    std::string path_;
+    int fd_;
+    result_cache cache_;
+    bool stop_;
+    std::deque<int> queue_;
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::mutex cwd_mutex_;
+
+    // only the owner may connect
+    bool bind_socket(const sockaddr_un& addr)
+    {
+        mode_t mask = umask(077);
+        bool ok = bind(fd_, (const sockaddr*)&addr, sizeof(addr)) == 0;
+        umask(mask);
+        return ok;
+    }
+
+    // the inputs of the current request are recorded while it runs
+    struct recording
+    {
+        explicit recording(input_list& inputs)
+        {   current_inputs() = &inputs;   }
+        ~recording()
+        {   current_inputs() = nullptr;   }
+    };
+
+    void work()
+    {
+        // on Linux each worker gets its own working directory, elsewhere
+        // requests take turns changing the one of the process
+        bool own_cwd = false;
+#if defined(__linux__)
+        own_cwd = unshare(CLONE_FS) == 0;
+#endif
+        for (;;)
+        {
+            int fd;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+                if (stop_)
+                    return;
+                fd = queue_.front();
+                queue_.pop_front();
+            }
+            std::unique_lock<std::mutex> lock(cwd_mutex_, std::defer_lock);
+            if (!own_cwd)
+                lock.lock();
+            serve(fd);
+            close(fd);
+        }
+    }
+
+    void serve(int fd)
+    {
+        std::uint32_t count;
+        if (!read_all(fd, &count, sizeof(count))
+        ||  count < 2
+        ||  count > server_max_strings)
+            return;
+        std::vector<std::string> request(count);
+        for (auto& s : request)
+            if (!read_string(fd, s))
+                return;
+
+        server_reply reply{ 0, "", "" };
+        if (request[0] != program_)
+        {
+            reply.status = 1;
+            reply.err
+            =   request[0] + ": " + path_ + " is served by " + program_ + '\n';
+            write_reply(fd, 0, reply);
+            return;
+        }
+        if (chdir(request[1].c_str()))
+        {
+            write_reply(fd, 1, reply);
+            return;
+        }
+
+        std::string key;
+        for (size_t i = 1; i < request.size(); ++i)
+            key.append(request[i]).push_back('\0');
+        input_list inputs;
+        if (cache_.find(key, reply, inputs)
+        &&  std::all_of
+            (   inputs.begin()
+            ,   inputs.end()
+            ,   [](const input_list::value_type& input)
+                {   return identify(input.first) == input.second;   }
+            ))
+        {
+            write_reply(fd, 0, reply);
+            return;
+        }
+
+        inputs.clear();
+        std::vector<char*> argv{ &request[0][0] };
+        for (size_t i = 2; i < request.size(); ++i)
+            argv.push_back(&request[i][0]);
+        argv.push_back(nullptr);
+        std::ostringstream out, err;
+        try
+        {
+            recording guard(inputs);
+            reply.status = run_(int(argv.size() - 1), argv.data(), out, err);
+        }
+        catch (not_servable&)
+        {
+            write_reply(fd, 1, server_reply{ 0, "", "" });
+            return;
+        }
+        reply.out = out.str();
+        reply.err = err.str();
+        cache_.insert(key, reply, inputs);
+        write_reply(fd, 0, reply);
+    }
+};
+
+// forwards args to the server on path; the client runs them itself when the
+// server cannot
+inline int run_client
+(   const std::string& program
+,   tool run
+,   const std::string& path
+,   std::vector<std::string> args
+)
+{
+    std::vector<char> cwd(4096);
+    while (nullptr == getcwd(cwd.data(), cwd.size()))
+    {
+        if (errno != ERANGE)
+            throw std::runtime_error(std::strerror(errno));
+        cwd.resize(cwd.size() * 2);
+    }
+    sockaddr_un addr = socket_address(path);
+    int fd = socket_stream();
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)))
+    {
+        std::string error = std::strerror(errno);
+        close(fd);
+        throw std::runtime_error("cannot connect to " + path + ": " + error);
+    }
+
+    std::uint32_t count = std::uint32_t(args.size() + 2);
+    bool ok = write_all(fd, &count, sizeof(count))
+    &&        write_string(fd, program)
+    &&        write_string(fd, cwd.data());
+    for (size_t i = 0; ok && i < args.size(); ++i)
+        ok = write_string(fd, args[i]);
+    std::uint8_t kind{};
+    std::int32_t status{};
+    server_reply reply{ 0, "", "" };
+    ok = ok
+    &&   read_all(fd, &kind, sizeof(kind))
+    &&   read_all(fd, &status, sizeof(status))
+    &&   read_string(fd, reply.out)
+    &&   read_string(fd, reply.err);
+    close(fd);
+    if (!ok)
+        throw std::runtime_error("no reply from " + path);
+
+    if (kind)
+    {
+        std::vector<char*> argv{ const_cast<char*>(program.c_str()) };
+        for (auto& arg : args)
+            argv.push_back(&arg[0]);
+        argv.push_back(nullptr);
+        return run(int(argv.size() - 1), argv.data(), std::cout, std::cerr);
+    }
+    std::cout.write(reply.out.data(), reply.out.size()).flush();
+    std::cerr.write(reply.err.data(), reply.err.size()).flush();
+    return status;
+}
+
+#endif  // !_WIN32
+
+// runs the tool directly, as a server (--serve SOCK) or as its client
+// (--connect SOCK)
+inline int dispatch(const char* program, int argc, char* argv[], tool run)
+{
+    std::string serve, connect;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--")
+        {
+            args.insert(args.end(), argv + i, argv + argc);
+            break;
+        }
+        bool taken = false;
+        for (auto option : { std::make_pair("--serve", &serve)
+                           , std::make_pair("--connect", &connect) })
+        {
+            std::string name = option.first;
+            if (arg.compare(0, name.size() + 1, name + '=') == 0)
+                *option.second = arg.substr(name.size() + 1);
+            else if (arg == name && i + 1 < argc)
+                *option.second = argv[++i];
+            else
+                continue;
+            taken = true;
+        }
+        if (!taken)
+            args.push_back(arg);
+    }
+    if (serve.empty() && connect.empty())
+        return run(argc, argv, std::cout, std::cerr);
+
+    try
+    {
+#if defined(_WIN32)
+        throw std::runtime_error("--serve and --connect are not supported "
+                                 "on this platform");
+#else
+        if (!serve.empty() && !connect.empty())
+            throw std::runtime_error("--serve and --connect cannot be combined");
+        if (!connect.empty())
+            return run_client(program, run, connect, args);
+        if (!args.empty())
+            throw std::runtime_error("--serve takes no other arguments");
+        server(program, run, serve).loop();
+        return 0;
+#endif
+    }
+    catch(std::exception& e)
+    {
+        std::cerr << program << ": " << e.what() << std::endl;
+        return 1;
+    }
+}
+
+} // end amstools namespace
+
+#endif  // AMSTOOLS_SERVER_HPP
@@ -0,0 +1,503 @@
+//
+// Copyright (C) 2022 Armin Sobhani <arminms@gmail.com>
+//
+// The MIT License
+//
+
+#ifndef AMSTOOLS_TWOBIT_HPP
+#define AMSTOOLS_TWOBIT_HPP
+
+// Reading and writing the UCSC .2bit format: a packed 2 bits/base encoding
+// (T=0, C=1, A=2, G=3, first base in the most significant bits) with tables
+// of N runs and soft-masked (lowercase) runs per sequence, preceded by a
+// directory of sequence names and record offsets.
+//
+//   header : signature, version, sequence count, reserved   (4 x uint32)
+//   index  : name size (uint8), name, offset (uint32, uint64 if version 1)
+//   record : dna size, N block count, N starts, N sizes, mask block count,
+//            mask starts, mask sizes, reserved (uint32), packed dna
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <utility>
+
+#include <inputs.hpp>
+
+#include <sys/stat.h>
+
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#endif
+#if defined(_WIN32)
+#   include <fstream>
+#   include <iterator>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <unistd.h>
+#endif
+
+namespace amstools {
+
+constexpr std::uint32_t twobit_signature = 0x1A412743;
+
+inline std::uint32_t bswap32(std::uint32_t v)
+{
+#if defined(_MSC_VER)
+    return _byteswap_ulong(v);
+#else
+    return __builtin_bswap32(v);
+#endif
+}
+
+inline std::uint64_t bswap64(std::uint64_t v)
+{
+#if defined(_MSC_VER)
+    return _byteswap_uint64(v);
+#else
+    return __builtin_bswap64(v);
+#endif
+}
+
+inline unsigned popcount64(std::uint64_t v)
+{
+#if defined(_MSC_VER)
+    return unsigned(__popcnt64(v));
+#else
+    return unsigned(__builtin_popcountll(v));
+#endif
+}
+
+// checks the magic number of a file without consuming any of it; only
+// regular files are opened, as the bytes read from a pipe or FIFO would be
+// lost to the reader opening it next (2bit files are mapped anyway)
+inline bool is_twobit(const std::string& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) || (st.st_mode & S_IFMT) != S_IFREG)
+        return false;
+    std::uint32_t magic{};
+    std::FILE* fp = std::fopen(path.c_str(), "rb");
+    if (nullptr == fp)
+        return false;
+    bool ok = std::fread(&magic, sizeof(magic), 1, fp) == 1;
+    std::fclose(fp);
+    return ok
+    &&  ( magic == twobit_signature
+    ||    magic == bswap32(twobit_signature) );
+}
+
+// number of T, C, A and G (in this order, i.e. by 2-bit code) residues
+struct twobit_counts
+{
+    size_t n[4];
+};
+
+// residue counts of a 2bit sequence, split by case with Ns separated
+struct twobit_composition
+{
+    size_t upper[4]; // T, C, A, G
+    size_t lower[4]; // t, c, a, g
+    size_t n_upper;  // N
+    size_t n_lower;  // n
+};
+
+class twobit_file
+{
+public:
+    struct block
+    {
+        std::uint32_t start, size;
+    };
+
+    explicit twobit_file(const std::string& path)
+    :   path_(path)
+    ,   data_(nullptr)
+    ,   size_(0)
+    ,   swap_(false)
+    {
+        note_input(path);
+        map();
+        parse_index();
+    }
+
+    ~twobit_file()
+    {
+#if !defined(_WIN32)
+        if (data_)
+            munmap(const_cast<std::uint8_t*>(data_), size_);
+#endif
+    }
+
+    twobit_file(const twobit_file&) = delete;
+    twobit_file& operator= (const twobit_file&) = delete;
+
+    size_t size() const
+    {   return names_.size();   }
+
+    const std::string& name(size_t i) const
+    {   return names_[i];   }
+
+    // sequence length straight from the record header
+    std::uint32_t length(size_t i) const
+    {   return u32(offsets_[i]);   }
+
+    std::vector<block> n_blocks(size_t i) const
+    {   return blocks(offsets_[i] + 4, length(i));   }
+
+    std::vector<block> mask_blocks(size_t i) const
+    {
+        std::uint64_t at = offsets_[i] + 4;
+        at += 4 + 8 * std::uint64_t(u32(at));
+        return blocks(at, length(i));
+    }
+
+    // residue composition computed with popcounts over the packed words
+    twobit_composition composition(size_t i) const
+    {
+        twobit_composition c{};
+        const std::uint8_t* dna = packed(i);
+        const size_t len = length(i);
+        auto all = count(dna, 0, len);
+        auto nb = n_blocks(i);
+        auto mb = mask_blocks(i);
+        for (const auto& b : nb)
+        {
+            auto in = count(dna, b.start, std::uint64_t(b.start) + b.size);
+            for (int j = 0; j < 4; ++j)
+                all.n[j] -= in.n[j];
+            c.n_upper += b.size;
+        }
+        size_t k = 0;
+        for (const auto& m : mb)
+        {
+            const std::uint64_t me = std::uint64_t(m.start) + m.size;
+            auto in = count(dna, m.start, me);
+            // both block lists are sorted, so overlaps are found by merging
+            while ( k < nb.size()
+            &&      std::uint64_t(nb[k].start) + nb[k].size <= m.start )
+                ++k;
+            for (size_t j = k; j < nb.size() && nb[j].start < me; ++j)
+            {
+                std::uint64_t s = std::max<std::uint64_t>(m.start, nb[j].start);
+                std::uint64_t e = std::min<std::uint64_t>
+                (   me
+                ,   std::uint64_t(nb[j].start) + nb[j].size
+                );
+                auto ov = count(dna, s, e);
+                for (int l = 0; l < 4; ++l)
+                    in.n[l] -= ov.n[l];
+                c.n_lower += e - s;
+                c.n_upper -= e - s;
+            }
+            for (int j = 0; j < 4; ++j)
+                c.lower[j] += in.n[j];
+        }
+        for (int j = 0; j < 4; ++j)
+            c.upper[j] = all.n[j] - c.lower[j];
+        return c;
+    }
+
+    // decodes a whole sequence including Ns and soft-masked runs
+    void sequence(size_t i, std::string& s) const
+    {   sequence(i, 0, length(i), s);   }
+
+    // decodes the [begin, end) range of a sequence, unpacking only the bytes
+    // covering it and applying only the blocks overlapping it
+    void sequence
+    (   size_t i
+    ,   std::uint64_t begin
+    ,   std::uint64_t end
+    ,   std::string& s
+    ) const
+    {
+        static const char bases[] = "TCAG";
+        const std::uint8_t* dna = packed(i);
+        end = std::min<std::uint64_t>(end, length(i));
+        begin = std::min(begin, end);
+        s.resize(size_t(end - begin));
+        for (std::uint64_t p = begin; p < end; ++p)
+            s[size_t(p - begin)] = bases[(dna[p >> 2] >> (6 - 2 * (p & 3))) & 3];
+        // the part of a block within the range, relative to begin
+        auto clip = [&](const block& b, size_t& first, size_t& last)
+        {
+            first = size_t(std::max<std::uint64_t>(b.start, begin) - begin);
+            last = size_t
+            (   std::min<std::uint64_t>(std::uint64_t(b.start) + b.size, end)
+            -   begin
+            );
+            return b.start < end && std::uint64_t(b.start) + b.size > begin;
+        };
+        size_t first, last;
+        for (const auto& b : n_blocks(i))
+            if (clip(b, first, last))
+                std::memset(&s[first], 'N', last - first);
+        for (const auto& b : mask_blocks(i))
+            if (clip(b, first, last))
+                for (size_t p = first; p < last; ++p)
+                    s[p] = char(s[p] | 0x20);
+    }
+
+    // counts residues by 2-bit code over the [first, last) range of bases
+    static twobit_counts count
+    (   const std::uint8_t* dna
+    ,   std::uint64_t first
+    ,   std::uint64_t last
+    )
+    {
+        twobit_counts c{};
+        // unaligned head and tail are counted one base at a time
+        while (first < last && (first & 3))
+        {
+            ++c.n[(dna[first >> 2] >> (6 - 2 * (first & 3))) & 3];
+            ++first;
+        }
+        while (last > first && (last & 3))
+        {
+            --last;
+            ++c.n[(dna[last >> 2] >> (6 - 2 * (last & 3))) & 3];
+        }
+        const std::uint8_t* p = dna + (first >> 2);
+        const std::uint8_t* end = dna + (last >> 2);
+        const std::uint64_t m = 0x5555555555555555ULL;
+        size_t hi_lo{}, hi_only{}, lo_only{}, any{};
+        for (; p + 8 <= end; p += 8)
+        {
+            std::uint64_t w;
+            std::memcpy(&w, p, sizeof(w));
+            std::uint64_t lo = w & m, hi = (w >> 1) & m;
+            hi_lo   += popcount64(hi & lo);
+            hi_only += popcount64(hi & ~lo);
+            lo_only += popcount64(lo & ~hi);
+            any     += popcount64(hi | lo);
+        }
+        const size_t bases = 4 * size_t(p - dna - (first >> 2));
+        c.n[0] += bases - any;
+        c.n[1] += lo_only;
+        c.n[2] += hi_only;
+        c.n[3] += hi_lo;
+        for (; p < end; ++p)
+            for (int s = 6; s >= 0; s -= 2)
+                ++c.n[(*p >> s) & 3];
+        return c;
+    }
+
+private:
+    std::string path_;
+    const std::uint8_t* data_;
+    size_t size_;
+    bool swap_;
+    std::vector<std::string> names_;
+    std::vector<std::uint64_t> offsets_;
+#if defined(_WIN32)
+    std::vector<std::uint8_t> buffer_;
+#endif
+
+    void map()
+    {
+#if defined(_WIN32)
+        std::ifstream in(path_, std::ios::binary);
+        if (!in)
+            throw std::runtime_error("error reading " + path_);
+        buffer_.assign
+        (   std::istreambuf_iterator<char>(in)
+        ,   std::istreambuf_iterator<char>()
+        );
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+#else
+        int fd = open(path_.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("error reading " + path_);
+        struct stat st;
+        if (fstat(fd, &st) < 0 || st.st_size < 16)
+        {
+            close(fd);
+            throw std::runtime_error("invalid 2bit file " + path_);
+        }
+        size_ = size_t(st.st_size);
+        void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (MAP_FAILED == p)
+            throw std::runtime_error("error mapping " + path_);
+        madvise(p, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const std::uint8_t*>(p);
+#endif
+    }
+
+    void check(std::uint64_t at, std::uint64_t n) const
+    {
+        if (at + n > size_)
+            throw std::runtime_error("truncated 2bit file " + path_);
+    }
+
+    std::uint32_t u32(std::uint64_t at) const
+    {
+        check(at, 4);
+        std::uint32_t v;
+        std::memcpy(&v, data_ + at, 4);
+        return swap_ ? bswap32(v) : v;
+    }
+
+    std::uint64_t u64(std::uint64_t at) const
+    {
+        check(at, 8);
+        std::uint64_t v;
+        std::memcpy(&v, data_ + at, 8);
+        return swap_ ? bswap64(v) : v;
+    }
+
+    void parse_index()
+    {
+        std::uint32_t magic;
+        std::memcpy(&magic, data_, 4);
+        if (magic == bswap32(twobit_signature))
+            swap_ = true;
+        else if (magic != twobit_signature)
+            throw std::runtime_error("invalid 2bit file " + path_);
+        auto version = u32(4);
+        if (version > 1)
+            throw std::runtime_error("unsupported 2bit version in " + path_);
+        auto n = u32(8);
+        names_.reserve(n);
+        offsets_.reserve(n);
+        std::uint64_t at = 16;
+        for (std::uint32_t i = 0; i < n; ++i)
+        {
+            check(at, 1);
+            size_t len = data_[at++];
+            check(at, len);
+            names_.emplace_back(reinterpret_cast<const char*>(data_ + at), len);
+            at += len;
+            offsets_.push_back(version ? u64(at) : u32(at));
+            at += version ? 8 : 4;
+            check(offsets_.back(), 16);
+        }
+    }
+
+    // the block list at at, each block lying within a sequence of length
+    // residues
+    std::vector<block> blocks(std::uint64_t at, std::uint32_t length) const
+    {
+        auto n = u32(at);
+        check(at + 4, 8 * std::uint64_t(n));
+        std::vector<block> b(n);
+        for (std::uint32_t i = 0; i < n; ++i)
+        {
+            b[i].start = u32(at + 4 + 4 * std::uint64_t(i));
+            b[i].size = u32(at + 4 + 4 * (std::uint64_t(n) + i));
+            if (b[i].start > length || b[i].size > length - b[i].start)
+                throw std::runtime_error("invalid 2bit file " + path_);
+        }
+        return b;
+    }
+
+    const std::uint8_t* packed(size_t i) const
+    {
+        std::uint64_t at = offsets_[i] + 4;
+        at += 4 + 8 * std::uint64_t(u32(at)); // N blocks
+        at += 4 + 8 * std::uint64_t(u32(at)); // mask blocks
+        at += 4;                              // reserved
+        check(at, (std::uint64_t(length(i)) + 3) / 4);
+        return data_ + at;
+    }
+};
+
+// accumulates one sequence into the packed record layout of a 2bit file
+class twobit_record
+{
+public:
+    void assign(const char* s, size_t l)
+    {
+        size_ = l;
+        n_.clear();
+        mask_.clear();
+        dna_.assign((l + 3) / 4, 0);
+        static const std::uint8_t code[] = { 2, 1, 3, 0 }; // A, C, G, T
+        bool in_n = false, in_mask = false;
+        for (size_t p = 0; p < l; ++p)
+        {
+            std::uint8_t c = std::uint8_t(s[p]);
+            bool lower = c >= 'a' && c <= 'z';
+            std::uint8_t u = c & 0xDF;
+            bool acgt = u == 'A' || u == 'C' || u == 'G' || u == 'T';
+            if (acgt)
+                dna_[p >> 2] |= code[((c >> 1) ^ (c >> 2)) & 3]
+                             << (6 - 2 * (p & 3));
+            extend(n_, in_n, !acgt, p);
+            extend(mask_, in_mask, lower, p);
+        }
+    }
+
+    std::uint32_t size() const
+    {   return std::uint32_t(size_);   }
+
+    // number of bytes this record takes in the file
+    std::uint64_t bytes() const
+    {   return 16 + 8 * (n_.size() + mask_.size()) + dna_.size();   }
+
+    void write(std::FILE* fp) const
+    {
+        put(fp, std::uint32_t(size_));
+        put_blocks(fp, n_);
+        put_blocks(fp, mask_);
+        put(fp, std::uint32_t(0));
+        if (dna_.size() && std::fwrite(dna_.data(), dna_.size(), 1, fp) != 1)
+            throw std::runtime_error("error writing 2bit file");
+    }
+
+    static void put(std::FILE* fp, std::uint32_t v)
+    {
+        if (std::fwrite(&v, sizeof(v), 1, fp) != 1)
+            throw std::runtime_error("error writing 2bit file");
+    }
+
+    static void put(std::FILE* fp, std::uint64_t v)
+    {
+        if (std::fwrite(&v, sizeof(v), 1, fp) != 1)
+            throw std::runtime_error("error writing 2bit file");
+    }
+
+private:
+    size_t size_{};
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> n_, mask_;
+    std::vector<std::uint8_t> dna_;
+
+    static void extend
+    (   std::vector<std::pair<std::uint32_t, std::uint32_t>>& runs
+    ,   bool& in_run
+    ,   bool inside
+    ,   size_t p
+    )
+    {
+        if (inside)
+        {
+            if (in_run)
+                ++runs.back().second;
+            else
+                runs.emplace_back(std::uint32_t(p), 1);
+        }
+        in_run = inside;
+    }
+
+    static void put_blocks
+    (   std::FILE* fp
+    ,   const std::vector<std::pair<std::uint32_t, std::uint32_t>>& runs
+    )
+    {
+        put(fp, std::uint32_t(runs.size()));
+        for (const auto& r : runs)
+            put(fp, r.first);
+        for (const auto& r : runs)
+            put(fp, r.second);
+    }
+};
+
+} // end amstools namespace
+
+#endif  // AMSTOOLS_TWOBIT_HPP
@@ -0,0 +1,445 @@
+//
+// Copyright (C) 2022 Armin Sobhani <arminms@gmail.com>
+//
+// The MIT License
+//
+
+#ifndef AMSTOOLS_VALIDATE_HPP
+#define AMSTOOLS_VALIDATE_HPP
+
+// Strict checking of FastA/FastQ input. kseq accepts malformed records
+// silently, so a validator is fed the same decompressed bytes kseq reads
+// (see in_read) and checks them line by line with a small state machine:
+//
+//   - records start with '>' or '@' followed by a name, and a file does not
+//     mix both kinds
+//   - residues are letters, '*' or '-'; qualities are '!' to '~'
+//   - FastQ sequences and qualities have the same length, the '+' line is
+//     empty or repeats the header, and the last record is complete
+//   - empty lines only appear at the end of the file
+//   - compressed input is not truncated or corrupt
+//
+// Lines ending in CR LF are accepted. Residues and qualities are checked 16
+// bytes at a time with SSE2 range compares, so validating costs little more
+// than counting. Errors give the record number and the offset of the byte in
+// the decompressed input; after one that breaks the structure of a record,
+// checking resumes at the next header line.
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   include <emmintrin.h>
+#   define AMSTOOLS_VALIDATE_SSE2
+#endif
+
+namespace amstools {
+
+// offset of the first byte of p that is not a residue, n if there is none
+inline size_t find_invalid_residue(const char* p, size_t n)
+{
+    size_t i = 0;
+#if defined(AMSTOOLS_VALIDATE_SSE2)
+    // bytes above 127 are negative, so they fail the signed range compares
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i before_a = _mm_set1_epi8('a' - 1);
+    const __m128i after_z = _mm_set1_epi8('z' + 1);
+    const __m128i star = _mm_set1_epi8('*');
+    const __m128i dash = _mm_set1_epi8('-');
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i l = _mm_or_si128(v, lower);
+        __m128i ok = _mm_or_si128
+        (   _mm_and_si128(_mm_cmpgt_epi8(l, before_a), _mm_cmplt_epi8(l, after_z))
+        ,   _mm_or_si128(_mm_cmpeq_epi8(v, star), _mm_cmpeq_epi8(v, dash))
+        );
+        if (_mm_movemask_epi8(ok) != 0xFFFF)
+            break;
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        unsigned char l = (unsigned char)(p[i] | 0x20) - 'a';
+        if (l >= 26 && p[i] != '*' && p[i] != '-')
+            return i;
+    }
+    return n;
+}
+
+// offset of the first byte of p that is not a quality, n if there is none
+inline size_t find_invalid_quality(const char* p, size_t n)
+{
+    size_t i = 0;
+#if defined(AMSTOOLS_VALIDATE_SSE2)
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i del = _mm_set1_epi8(127);
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i ok = _mm_and_si128
+        (   _mm_cmpgt_epi8(v, space)
+        ,   _mm_cmplt_epi8(v, del)
+        );
+        if (_mm_movemask_epi8(ok) != 0xFFFF)
+            break;
+    }
+#endif
+    for (; i < n; ++i)
+        if ((unsigned char)(p[i] - '!') > '~' - '!')
+            return i;
+    return n;
+}
+
+class validator
+{
+public:
+    struct error
+    {
+        size_t record;      // 1-based, 0 before the first record
+        long long offset;   // in the decompressed input
+        std::string what;
+    };
+
+    // keeps the first max_errors errors, counting the others
+    explicit validator(size_t max_errors = 10)
+    :   max_errors_(max_errors)
+    ,   count_(0)
+    ,   offset_(0)
+    ,   record_(0)
+    ,   marker_(0)
+    ,   part_(part::header)
+    ,   kind_(line::start)
+    ,   line_start_(0)
+    ,   line_len_(0)
+    ,   line_bad_(false)
+    ,   cr_(false)
+    ,   resync_(false)
+    ,   corrupt_(false)
+    ,   blank_(-1)
+    ,   seq_len_(0)
+    ,   seq_lines_(0)
+    ,   qual_len_(0)
+    ,   qual_lines_(0)
+    ,   qual_start_(0)
+    {}
+
+    // checks the next n bytes of decompressed input
+    void feed(const char* p, size_t n)
+    {
+        const char* const end = p + n;
+        while (p < end)
+        {
+            if (line::start == kind_)
+                begin_line(*p);
+            auto nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            const char* stop = nl ? nl : end;
+            span(p, stop, nl != nullptr);
+            offset_ += stop - p;
+            p = stop;
+            if (nl)
+            {
+                end_line();
+                ++p;
+                ++offset_;
+            }
+        }
+    }
+
+    // the input could not be decompressed past the bytes fed so far
+    void corrupt()
+    {
+        if (!corrupt_)
+            fail(offset_, "corrupt or truncated compressed input");
+        corrupt_ = true;
+    }
+
+    // checks that the input ends with a complete record
+    void finish()
+    {
+        if (corrupt_)
+            return;
+        cr_ = false;
+        if (kind_ != line::start)
+            end_line();
+        if ( (part::sequence == part_ && '@' == marker_)
+        ||   part::quality == part_ )
+            fail(offset_, "truncated record");
+        part_ = part::header;
+    }
+
+    bool ok() const
+    {   return 0 == count_;   }
+
+    size_t error_count() const
+    {   return count_;   }
+
+    const std::vector<error>& errors() const
+    {   return errors_;   }
+
+private:
+    enum class part { header, sequence, quality };  // expected next
+    enum class line { start, header, sequence, plus, quality, other, skip };
+
+    size_t max_errors_;
+    size_t count_;
+    std::vector<error> errors_;
+    long long offset_;          // of the next byte fed
+    size_t record_;
+    char marker_;               // '>' or '@' once known
+    part part_;
+    line kind_;                 // of the current line
+    long long line_start_;
+    size_t line_len_;           // without the trailing CR
+    bool line_bad_;             // an invalid byte was reported on the line
+    bool cr_;                   // the previous chunk ended with a CR
+    bool resync_;               // skipping lines up to the next header
+    bool corrupt_;
+    long long blank_;           // first of the pending empty lines
+    std::string head_, plus_;
+    unsigned long long seq_len_, seq_lines_, qual_len_, qual_lines_;
+    long long qual_start_;
+
+    void fail(long long offset, const std::string& what)
+    {
+        if (errors_.size() < max_errors_)
+            errors_.push_back(error{ record_, offset, what });
+        ++count_;
+    }
+
+    // a structural error; the rest of the record is skipped
+    void fail_record(long long offset, const std::string& what)
+    {
+        fail(offset, what);
+        resync_ = true;
+        part_ = part::header;
+        kind_ = line::skip;
+    }
+
+    void begin_line(char c)
+    {
+        line_start_ = offset_;
+        line_len_ = 0;
+        line_bad_ = false;
+        if (resync_)
+        {
+            if (marker_ ? c != marker_ : c != '>' && c != '@')
+            {
+                kind_ = line::skip;
+                return;
+            }
+            resync_ = false;
+        }
+        if (blank_ >= 0 && c != '\n' && c != '\r')
+            flush_blank();
+        switch (part_)
+        {
+            case part::header:
+                kind_ = '>' == c || '@' == c ? line::header : line::other;
+                break;
+            case part::sequence:
+                if ('>' == marker_ && '>' == c)
+                    kind_ = line::header;
+                else if ('@' == marker_ && '+' == c)
+                    kind_ = line::plus;
+                else
+                    kind_ = line::sequence;
+                break;
+            case part::quality:
+                kind_ = line::quality;
+                break;
+        }
+        if (line::header == kind_)
+        {
+            if (marker_ && c != marker_)
+            {
+                fail_record(offset_, "FastA and FastQ records are mixed");
+                return;
+            }
+            marker_ = c;
+            ++record_;
+            head_.clear();
+        }
+        else if (line::plus == kind_)
+            plus_.clear();
+    }
+
+    // the bytes [p, q) of the current line, the last ones if eol
+    void span(const char* p, const char* q, bool eol)
+    {
+        long long at = offset_;
+        if (cr_)
+        {
+            // a CR not followed by LF
+            cr_ = false;
+            if (q > p)
+                invalid(at - 1, '\r');
+        }
+        if (q > p && '\r' == q[-1])
+        {
+            --q;
+            cr_ = !eol;
+        }
+        size_t n = q - p;
+        line_len_ += n;
+        switch (kind_)
+        {
+            case line::header:
+                // the marker itself is not part of the title
+                if (at == line_start_ && n)
+                    head_.append(p + 1, n - 1);
+                else
+                    head_.append(p, n);
+                break;
+            case line::plus:
+                if (at == line_start_ && n)
+                    plus_.append(p + 1, n - 1);
+                else
+                    plus_.append(p, n);
+                break;
+            case line::sequence:
+            {
+                size_t i = find_invalid_residue(p, n);
+                if (i < n)
+                    invalid(at + i, p[i]);
+                seq_len_ += n;
+                break;
+            }
+            case line::quality:
+            {
+                size_t i = find_invalid_quality(p, n);
+                if (i < n)
+                    invalid(at + i, p[i]);
+                qual_len_ += n;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    void invalid(long long offset, char c)
+    {
+        if (line_bad_)
+            return;
+        line_bad_ = true;
+        static const char* hex = "0123456789abcdef";
+        std::string what = line::quality == kind_
+        ?   "invalid quality character "
+        :   "invalid residue character ";
+        if (c > ' ' && c < 127)
+            what += std::string("'") + c + "'";
+        else
+        {
+            what += "0x";
+            what += hex[(unsigned char)c >> 4];
+            what += hex[c & 15];
+        }
+        fail(offset, what);
+    }
+
+    void flush_blank()
+    {
+        fail(blank_, "empty line");
+        blank_ = -1;
+    }
+
+    void end_line()
+    {
+        if (blank_ >= 0 && line_len_ && kind_ != line::skip)
+            flush_blank();
+        switch (kind_)
+        {
+            case line::header:
+                end_header();
+                break;
+            case line::sequence:
+                // the first line of a FastQ record is its sequence, even if
+                // empty
+                if (0 == line_len_ && !('@' == marker_ && 0 == seq_lines_))
+                {
+                    if (blank_ < 0)
+                        blank_ = line_start_;
+                }
+                else
+                    ++seq_lines_;
+                break;
+            case line::plus:
+                if (!plus_.empty() && plus_ != head_)
+                    fail(line_start_, "'+' line does not match the header");
+                part_ = part::quality;
+                qual_len_ = 0;
+                qual_lines_ = 0;
+                qual_start_ = offset_ + 1;
+                break;
+            case line::quality:
+                ++qual_lines_;
+                if (qual_len_ >= seq_len_)
+                {
+                    if (qual_len_ > seq_len_)
+                        fail_record
+                        (   qual_start_
+                        ,   "quality length " + std::to_string(qual_len_)
+                        +   " differs from sequence length "
+                        +   std::to_string(seq_len_)
+                        );
+                    part_ = part::header;
+                }
+                break;
+            case line::other:
+                if (line_len_)
+                    fail_record(line_start_, "expected '>' or '@'");
+                else if (blank_ < 0)
+                    blank_ = line_start_;
+                break;
+            default:
+                break;
+        }
+        kind_ = line::start;
+    }
+
+    void end_header()
+    {
+        if (head_.empty() || ' ' == head_[0] || '\t' == head_[0])
+            fail(line_start_, "missing sequence name");
+        for (size_t i = 0; i < head_.size(); ++i)
+            if ((unsigned char)head_[i] < ' ' && head_[i] != '\t')
+            {
+                fail(line_start_ + 1 + i, "invalid character in header");
+                break;
+            }
+        part_ = part::sequence;
+        seq_len_ = 0;
+        seq_lines_ = 0;
+    }
+};
+
+// prints the errors found in file as "program: file: record R, offset O: ..."
+// and returns whether there were none
+inline bool print_errors
+(   std::ostream& err
+,   const std::string& program
+,   const std::string& file
+,   const validator& check
+)
+{
+    for (const auto& e : check.errors())
+    {
+        err << program << ": " << file << ": ";
+        if (e.record)
+            err << "record " << e.record << ", ";
+        err << "offset " << e.offset << ": " << e.what << '\n';
+    }
+    if (check.error_count() > check.errors().size())
+        err << program << ": " << file << ": "
+            << check.error_count() - check.errors().size()
+            << " more errors\n";
+    err.flush();
+    return check.ok();
+}
+
+} // end amstools namespace
+
+#endif  // AMSTOOLS_VALIDATE_HPP
@@ -0,0 +1,238 @@
+//
+// Copyright (C) 2022 Armin Sobhani <arminms@gmail.com>
+//
+// The MIT License
+//
+
+#ifndef AMSTOOLS_WORKERS_HPP
+#define AMSTOOLS_WORKERS_HPP
+
+// Reading several FILEs at a time. Each worker thread takes the next file,
+// reads it with its own parser and accumulators and publishes the result once
+// at the end, so workers never write to memory shared with each other while
+// counting. The results are then reduced and printed by the calling thread in
+// the order of the files, making the output the same as reading them one at a
+// time.
+//
+// Workers can be pinned to a list of CPUs (e.g. those of one socket). As a
+// worker is pinned before it allocates anything, the buffers of the files it
+// reads are first touched, and so placed, on its own NUMA node.
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__linux__)
+#   include <pthread.h>
+#   include <sched.h>
+#endif
+
+#include <inputs.hpp>
+
+namespace amstools {
+
+// CPUs of a list such as 0-7,16,18-19, in order and without duplicates
+inline std::vector<unsigned> parse_cpus(const std::string& list)
+{
+    std::vector<unsigned> cpus;
+    auto bad = [&]
+    {   return std::invalid_argument("invalid CPU list '" + list + "'");   };
+    size_t pos = 0;
+    while (pos <= list.size())
+    {
+        size_t end = list.find(',', pos);
+        if (std::string::npos == end)
+            end = list.size();
+        std::string item = list.substr(pos, end - pos);
+        size_t dash = item.find('-');
+        std::string first = item.substr(0, dash);
+        std::string last = std::string::npos == dash
+        ?   first
+        :   item.substr(dash + 1);
+        if (first.empty() || last.empty()
+        ||  first.find_first_not_of("0123456789") != std::string::npos
+        ||  last.find_first_not_of("0123456789") != std::string::npos
+        ||  first.size() > 6 || last.size() > 6)
+            throw bad();
+        unsigned lo = unsigned(std::strtoul(first.c_str(), nullptr, 10));
+        unsigned hi = unsigned(std::strtoul(last.c_str(), nullptr, 10));
+        if (lo > hi)
+            throw bad();
+        for (unsigned cpu = lo; cpu <= hi; ++cpu)
+            if (std::find(cpus.begin(), cpus.end(), cpu) == cpus.end())
+                cpus.push_back(cpu);
+        pos = end + 1;
+    }
+    return cpus;
+}
+
+// throws unless the calling thread may run on each of cpus
+inline void check_cpus(const std::vector<unsigned>& cpus)
+{
+#if defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed))
+        throw std::runtime_error("cannot get the CPU affinity");
+    for (auto cpu : cpus)
+        if (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed))
+            throw std::invalid_argument
+            (   "CPU " + std::to_string(cpu) + " is not available"   );
+#else
+    if (!cpus.empty())
+        throw std::invalid_argument("--cpus is not supported on this platform");
+#endif
+}
+
+// pins the calling thread to cpu
+inline void pin_thread(unsigned cpu)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)cpu;
+#endif
+}
+
+// Calls task(i) for each i in [0, n) on up to threads worker threads, pinned
+// in turn to the CPUs in cpus if any, and emit(i) on the calling thread in the
+// order of i, as soon as task(i) is done. Workers stay at most two tasks each
+// ahead of emit, bounding the memory held by unemitted results. An exception
+// thrown by task(i) is rethrown in place of emit(i).
+//
+// With a single thread and no CPUs the tasks run on the calling thread.
+template <typename Task, typename Emit>
+void for_each_ordered
+(   size_t n
+,   unsigned threads
+,   const std::vector<unsigned>& cpus
+,   Task task
+,   Emit emit
+)
+{
+    if (threads <= 1 && cpus.empty())
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            task(i);
+            emit(i);
+        }
+        return;
+    }
+    threads = unsigned(std::min<size_t>(std::max(1U, threads), n));
+
+    // inside the server the inputs of each task are noted separately and
+    // added to those of the request in order
+    input_list* inputs = current_inputs();
+    std::vector<input_list> task_inputs(inputs ? n : 0);
+
+    std::vector<char> done(n);
+    std::vector<std::exception_ptr> errors(n);
+    std::atomic<size_t> next(0);
+    size_t emitted = 0;
+    bool stop = false;
+    std::mutex mutex;
+    std::condition_variable cv;
+    const size_t window = 2 * size_t(threads);
+
+    auto work = [&](unsigned w)
+    {
+        if (!cpus.empty())
+            pin_thread(cpus[w % cpus.size()]);
+        for (;;)
+        {
+            size_t i = next.fetch_add(1);
+            if (i >= n)
+                return;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return stop || i < emitted + window; });
+                if (stop)
+                    return;
+            }
+            current_inputs() = inputs ? &task_inputs[i] : nullptr;
+            try
+            {
+                task(i);
+            }
+            catch (...)
+            {
+                errors[i] = std::current_exception();
+            }
+            current_inputs() = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done[i] = 1;
+            }
+            cv.notify_all();
+        }
+    };
+
+    // stops and joins the workers however emit returns
+    struct joiner
+    {
+        std::vector<std::thread> workers;
+        std::mutex& mutex;
+        std::condition_variable& cv;
+        bool& stop;
+
+        ~joiner()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            cv.notify_all();
+            for (auto& t : workers)
+                t.join();
+        }
+    } pool{ {}, mutex, cv, stop };
+    for (unsigned w = 0; w < threads; ++w)
+        pool.workers.emplace_back(work, w);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return done[i] != 0; });
+        }
+        if (inputs)
+            inputs->insert
+            (   inputs->end()
+            ,   task_inputs[i].begin()
+            ,   task_inputs[i].end()
+            );
+        if (errors[i])
+            std::rethrow_exception(errors[i]);
+        emit(i);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            emitted = i + 1;
+        }
+        cv.notify_all();
+    }
+}
+
+// number of threads given by --threads, or one per CPU when it is 0
+inline unsigned thread_count(unsigned threads, const std::vector<unsigned>& cpus)
+{
+    if (threads)
+        return threads;
+    if (!cpus.empty())
+        return unsigned(cpus.size());
+    return std::max(1U, std::thread::hardware_concurrency());
+}
+
+} // end amstools namespace
+
+#endif  // AMSTOOLS_WORKERS_HPP
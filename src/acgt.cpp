@@ -7,21 +7,258 @@
 #include <iostream>
 #include <cstdio>
 #include <iomanip>
+#include <sstream>
+#include <memory>
 #include <unordered_map>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <algorithm>
 
 #include <zlib.h>
 #include <kseq.h>
 #include <cxxopts.hpp>
+#include <twobit.hpp>
+#include <instream.hpp>
+#include <faidx.hpp>
+#include <server.hpp>
+#include <checksum.hpp>
+#include <workers.hpp>
 
 #include <version.hpp>
 
-KSEQ_INIT(gzFile, gzread)
+KSEQ_INIT(amstools::instream*, amstools::in_read)
 
-int main(int argc, char* argv[])
+// counting k-mers (k <= 8) of nucleotide sequences into a dense array of 4^k
+// entries using a 2-bit rolling encoding (A=0, C=1, G=2, T=3) that restarts
+// at every non-ACGT residue; soft-masked (lowercase) residues are included
+class kmer_counter
 {
-    // turning sync off before any standard i/o occurs
-    std::cout.sync_with_stdio(false);
+public:
+    static constexpr unsigned max_k = 8;
+
+    kmer_counter(unsigned k, bool canonical)
+    :   k_(k)
+    ,   mask_((std::uint32_t(1) << (2 * k)) - 1)
+    ,   canonical_(canonical)
+    ,   counts_(size_t(1) << (2 * k))
+    ,   bases_{}
+    {}
+
+    void operator() (const char* s, size_t l)
+    {
+        std::uint32_t fw{}, rv{};
+        unsigned len{};
+        const unsigned shift = 2 * (k_ - 1);
+        std::uint8_t code[4096];
+        for (size_t first = 0; first < l; first += sizeof(code))
+        {
+            const size_t n = std::min(l - first, sizeof(code));
+
+            // 1. translating residues to 2-bit codes, or 4 for non-ACGT; this
+            //    part is branch-free so compilers can vectorize it
+            for (size_t i = 0; i < n; ++i)
+            {
+                std::uint8_t c = std::uint8_t(s[first + i]);
+                std::uint8_t u = c & 0xDF; // to uppercase
+                std::uint8_t acgt
+                =   (u == 'A') | (u == 'C') | (u == 'G') | (u == 'T');
+                code[i] = acgt
+                ?   std::uint8_t(((c >> 1) ^ (c >> 2)) & 3)
+                :   std::uint8_t(4);
+            }
+
+            // 2. rolling over the codes
+            for (size_t i = 0; i < n; ++i)
+            {
+                std::uint32_t c = code[i];
+                if (c > 3)
+                {
+                    len = 0;
+                    fw = rv = 0;
+                    continue;
+                }
+                ++bases_[c];
+                fw = ((fw << 2) | c) & mask_;
+                rv = (rv >> 2) | ((3 - c) << shift);
+                if (++len >= k_)
+                    ++counts_[canonical_ && rv < fw ? rv : fw];
+            }
+        }
+    }
+
+    unsigned k() const
+    {   return k_;   }
+
+    bool canonical() const
+    {   return canonical_;   }
+
+    // number of k-mers (or canonical k-mers) with the given code
+    size_t count(std::uint32_t code) const
+    {   return counts_[code];   }
+
+    // number of A, C, G and T residues (case-insensitive) seen so far
+    size_t bases(unsigned code) const
+    {   return bases_[code];   }
+
+    size_t total() const
+    {
+        size_t sum{};
+        for (auto n : counts_)
+            sum += n;
+        return sum;
+    }
+
+    // true if code is the canonical (smaller) one of a k-mer and its reverse
+    // complement
+    bool is_canonical(std::uint32_t code) const
+    {
+        std::uint32_t rc{};
+        for (unsigned i = 0, c = code; i < k_; ++i, c >>= 2)
+            rc = (rc << 2) | (3 - (c & 3));
+        return code <= rc;
+    }
+
+    std::string kmer(std::uint32_t code) const
+    {
+        std::string s(k_, 'A');
+        for (unsigned i = k_; i-- > 0; code >>= 2)
+            s[i] = "ACGT"[code & 3];
+        return s;
+    }
+
+    // observed/expected CpG ratio (Gardiner-Garden and Frommer, 1987); only
+    // meaningful when counting dinucleotides (k = 2)
+    double cpg_oe() const
+    {
+        double c = double(bases_[1]), g = double(bases_[2]);
+        double n = double(bases_[0] + bases_[1] + bases_[2] + bases_[3]);
+        return c * g > 0.0 ? double(counts_[6]) * n / (c * g) : 0.0;
+    }
+
+private:
+    unsigned k_;
+    std::uint32_t mask_;
+    bool canonical_;
+    std::vector<size_t> counts_;
+    size_t bases_[4];
+};
+
+// base quality statistics of FastQ records; the Phred offset is subtracted
+// from the histogram of raw quality characters when reporting, so counting
+// is a plain byte histogram (split in four to break store-to-load chains)
+// and an optional per-position sum that compilers can vectorize
+class quality_counter
+{
+public:
+    explicit quality_counter(bool profile)
+    :   profile_(profile)
+    ,   hist_{}
+    {}
+
+    void operator() (const char* q, size_t l)
+    {
+        const std::uint8_t* p = reinterpret_cast<const std::uint8_t*>(q);
+        size_t i = 0;
+        for (; i + 4 <= l; i += 4)
+        {
+            ++hist_[0][p[i]];
+            ++hist_[1][p[i + 1]];
+            ++hist_[2][p[i + 2]];
+            ++hist_[3][p[i + 3]];
+        }
+        for (; i < l; ++i)
+            ++hist_[0][p[i]];
+        if (profile_ && l)
+        {
+            if (sums_.size() < l)
+            {
+                sums_.resize(l);
+                reads_.resize(l + 1);
+            }
+            std::uint64_t* sum = sums_.data();
+            for (size_t j = 0; j < l; ++j)
+                sum[j] += p[j];
+            ++reads_[l];
+        }
+    }
+
+    // number of quality values seen so far
+    size_t size() const
+    {
+        size_t n{};
+        for (int c = 0; c < 256; ++c)
+            n += count(c);
+        return n;
+    }
+
+    // Phred offset given (33 or 64) or detected from the range of quality
+    // characters: 33 unless none is below '@' (Q0 in Phred+64) and some are
+    // above 'J' (Q41 in Phred+33), as high quality Phred+33 reads can lack
+    // low characters
+    unsigned offset(unsigned phred) const
+    {
+        if (phred)
+            return phred;
+        int lo = 256, hi = -1;
+        for (int c = 0; c < 256; ++c)
+            if (count(c))
+            {
+                lo = std::min(lo, c);
+                hi = c;
+            }
+        return lo >= '@' && hi > 'J' ? 64 : 33;
+    }
+
+    double mean(unsigned offset) const
+    {
+        double sum{}, n{};
+        for (int c = 0; c < 256; ++c)
+        {
+            sum += double(count(c)) * (c - int(offset));
+            n += double(count(c));
+        }
+        return n > 0.0 ? sum / n : 0.0;
+    }
+
+    // percentage of bases with quality of at least q
+    double percent(unsigned q, unsigned offset) const
+    {
+        double above{}, n{};
+        for (int c = 0; c < 256; ++c)
+        {
+            if (c >= int(offset + q))
+                above += double(count(c));
+            n += double(count(c));
+        }
+        return n > 0.0 ? above / n * 100 : 0.0;
+    }
+
+    // mean quality at each position of the reads
+    std::vector<double> profile(unsigned offset) const
+    {
+        std::vector<double> means(sums_.size());
+        size_t covering{};
+        for (size_t pos = sums_.size(); pos-- > 0; )
+        {
+            covering += reads_[pos + 1];
+            means[pos] = double(sums_[pos]) / covering - offset;
+        }
+        return means;
+    }
+
+private:
+    bool profile_;
+    size_t hist_[4][256];
+    std::vector<std::uint64_t> sums_;
+    std::vector<size_t> reads_;     // number of reads by length
+
+    size_t count(int c) const
+    {   return hist_[0][c] + hist_[1][c] + hist_[2][c] + hist_[3][c];   }
+};
 
+int run(int argc, char* argv[], std::ostream& out, std::ostream& err)
+{
     try
     {
         cxxopts::Options options("acgt", " (amstools) -- print residue statistics\n");
@@ -29,11 +266,26 @@ int main(int argc, char* argv[])
             "[OPTION]... [FILE]...\n"
             "  acgt [OPTION]... --files-from=F\n\n"
             "Print residue statistics and optionally GC and AT contents for each"
-            " FILE.\nBoth FastA and FastQ (optionally gzipped) files are "
-            "supported.\n\nWith no FILE, or when FILE is -, read standard "
+            " FILE.\nFastA and FastQ (optionally compressed) files as well as 2bit "
+            "files are\nsupported.\n\nWith no FILE, or when FILE is -, read standard "
             "input.\n\nThe options below may be used to select which statistics "
             "are printed,\nalways in the following order: #seq, #res, residue "
-            "statistics, AT-Content,\nGC-Content."
+            "statistics, AT-Content,\nGC-Content, CpG o/e ratio, mean base "
+            "quality, Q20 and Q30 percentages. The\nk-mer spectrum and the "
+            "per-position quality profile, if requested, are printed\n"
+            "after them.\n\nWith --regions or --regions-file, only the given "
+            "sequences or regions of each\nFILE are read using its .fai index, "
+            "built when missing.\n\nWith --checksum, the first digest stays the "
+            "same when the records are\nreordered, the second does not. Neither "
+            "depends on the compression of FILE.\n\nWith --validate, malformed "
+            "records, invalid residues or qualities\nand truncated input are "
+            "reported with the record number and the offset of the\nerror in "
+            "the decompressed FILE.\n\nWith --threads, several FILEs are read "
+            "at a time, each by one thread, and their\nstatistics printed in "
+            "order. --cpus pins these threads, e.g. to the CPUs of one\nNUMA "
+            "node, whose memory then holds their buffers.\n\nWith --serve, acgt stays resident and "
+            "answers acgt --connect clients,\nkeeping the statistics of FILEs "
+            "that have not changed since."
         );
         options.add_options()
         (   "a,AT-Content"
@@ -42,6 +294,9 @@ int main(int argc, char* argv[])
         (   "g,GC-Content"
         ,   "print GC-Content percent"
         )
+        (   "c,CpG"
+        ,   "print CpG observed/expected ratio"
+        )
         (   "f,files-from"
         ,   "read input from the files specified by\n"
             "  names separated by newlines in file F\n"
@@ -49,6 +304,47 @@ int main(int argc, char* argv[])
         ,   cxxopts::value<std::string>()
         ,   "F"
         )
+        (   "k,kmer"
+        ,   "print the k-mer spectrum for k = K (1-8)"
+        ,   cxxopts::value<unsigned>()
+        ,   "K"
+        )
+        (   "canonical"
+        ,   "merge k-mers with their reverse complements\n"
+            "  in the k-mer spectrum"
+        )
+        (   "checksum"
+        ,   "print order-independent and order-dependent\n"
+            "  digests of the sequences (W=seq) or of\n"
+            "  whole records (W=all)"
+        ,   cxxopts::value<std::string>()->implicit_value("seq")
+        ,   "W"
+        )
+        (   "q,quality"
+        ,   "print mean base quality and percentages of\n"
+            "  bases with quality of at least 20 and 30"
+        )
+        (   "quality-profile"
+        ,   "print the mean base quality at each position"
+        )
+        (   "phred"
+        ,   "Phred offset of qualities (33 or 64); it is\n"
+            "  detected if not provided"
+        ,   cxxopts::value<unsigned>()
+        ,   "P"
+        )
+        (   "regions"
+        ,   "read only the comma separated regions\n"
+            "  NAME, NAME:BEG or NAME:BEG-END in L"
+        ,   cxxopts::value<std::string>()
+        ,   "L"
+        )
+        (   "regions-file"
+        ,   "read only the regions listed one per line\n"
+            "  in file F"
+        ,   cxxopts::value<std::string>()
+        ,   "F"
+        )
         (   "r,residues"
         ,   "list of characters to count as residues\n"
         ,   cxxopts::value<std::string>()
@@ -56,6 +352,36 @@ int main(int argc, char* argv[])
         ->  implicit_value("ACGT")
         ,   "R"
         )
+        (   "validate"
+        ,   "check that FILEs are well-formed, reporting\n"
+            "  the first errors of each; the exit status\n"
+            "  is 1 if any is not"
+        )
+        (   "threads"
+        ,   "read up to N FILEs at a time (default: 1,\n"
+            "  or one per CPU of --cpus); 0 means one\n"
+            "  per CPU"
+        ,   cxxopts::value<unsigned>()
+        ,   "N"
+        )
+        (   "cpus"
+        ,   "pin the threads reading FILEs to the CPUs\n"
+            "  in LIST (e.g. 0-7,16-23)"
+        ,   cxxopts::value<std::string>()
+        ,   "LIST"
+        )
+        (   "serve"
+        ,   "stay resident and answer the requests of\n"
+            "  --connect clients on the Unix domain\n"
+            "  socket SOCK"
+        ,   cxxopts::value<std::string>()
+        ,   "SOCK"
+        )
+        (   "connect"
+        ,   "run through the server listening on SOCK"
+        ,   cxxopts::value<std::string>()
+        ,   "SOCK"
+        )
         (   "help"
         ,   "display this help and exit"
         )
@@ -75,49 +401,143 @@ int main(int argc, char* argv[])
 
         if (result.count("help"))
         {
-            std::cout << options.program()
-                      << options.help()
-                      << std::endl;
+            out << options.program()
+                << options.help()
+                << std::endl;
             return 0 ;
         }
 
         if (result.count("version"))
         {
-            std::cout << options.program()
-                      << AMSTOOLS_VERSION
-                      << std::endl;
+            out << options.program()
+                << AMSTOOLS_VERSION
+                << std::endl;
             return 0 ;
         }
 
         if (result.count("files") && result.count("files-from"))
         {
-            std::cerr << options.program() << ": "
-                        << "file operands cannot be combined with --files-from"
-                        << std::endl;
+            err << options.program() << ": "
+                  << "file operands cannot be combined with --files-from"
+                  << std::endl;
+            return 1;
+        }
+
+        unsigned k{};
+        if (result.count("kmer"))
+        {
+            k = result["kmer"].as<unsigned>();
+            if (k < 1 || k > kmer_counter::max_k)
+            {
+                err << options.program() << ": "
+                    << "k-mer size must be between 1 and "
+                    << kmer_counter::max_k
+                    << std::endl;
+                return 1;
+            }
+        }
+
+        unsigned phred{};
+        if (result.count("phred"))
+        {
+            phred = result["phred"].as<unsigned>();
+            if (phred != 33 && phred != 64)
+            {
+                err << options.program() << ": "
+                    << "Phred offset must be 33 or 64"
+                    << std::endl;
+                return 1;
+            }
+        }
+        const bool quality = result.count("quality")
+                          || result.count("quality-profile");
+
+        std::string checksum;
+        if (result.count("checksum"))
+        {
+            checksum = result["checksum"].as<std::string>();
+            if (checksum != "seq" && checksum != "all")
+            {
+                err << options.program() << ": "
+                    << "--checksum must be seq or all"
+                    << std::endl;
+                return 1;
+            }
+        }
+        const bool whole = checksum == "all";
+
+        std::vector<std::string> regions;
+        if (result.count("regions"))
+            regions = amstools::split_regions(result["regions"].as<std::string>());
+        if (result.count("regions-file"))
+        {
+            auto more = amstools::read_regions(result["regions-file"].as<std::string>());
+            regions.insert(regions.end(), more.begin(), more.end());
+        }
+        const bool selected = result.count("regions") || result.count("regions-file");
+        if (selected && 0 == result.count("files") && 0 == result.count("files-from"))
+        {
+            err << options.program() << ": "
+                  << "regions require indexable FILE operands"
+                  << std::endl;
+            return 1;
+        }
+        const bool validate = result.count("validate") > 0;
+        if (selected && validate)
+        {
+            err << options.program() << ": "
+                << "--validate reads whole FILEs and cannot be combined "
+                   "with regions"
+                << std::endl;
             return 1;
         }
+        bool valid = true;
+
+        std::vector<unsigned> cpus;
+        if (result.count("cpus"))
+        {
+            cpus = amstools::parse_cpus(result["cpus"].as<std::string>());
+            amstools::check_cpus(cpus);
+        }
+        const unsigned threads = amstools::thread_count
+        (   result.count("threads")
+            ?   result["threads"].as<unsigned>()
+            :   cpus.empty() ? 1 : 0
+        ,   cpus
+        );
 
         // std::cout << result.arguments().size() << std::endl;
 
         // printing header
         auto& residues = result["residues"].as<std::string>();
-        std::cout << std::setw(10) << std::left << "#Seq" << ' '
-                  << std::setw(10) << std::left << "#Res" << ' ';
+        out << std::setw(10) << std::left << "#Seq" << ' '
+            << std::setw(10) << std::left << "#Res" << ' ';
         if ( result.count("residues")
         || (0 == result.count("GC-Content")
         &&  0 == result.count("AT-Content")
+        &&  0 == result.count("CpG")
+        &&  0 == result.count("quality")
         &&  0 == result.count("residues") ) )
         {
             for (size_t i = 0; i < residues.size(); ++i)
-                std::cout << '#' << std::setw(10) << std::left << residues[i];
+                out << '#' << std::setw(10) << std::left << residues[i];
             for (size_t i = 0; i < residues.size(); ++i)
-                std::cout << '%' << std::setw(6) << std::left << residues[i];
+                out << '%' << std::setw(6) << std::left << residues[i];
         }
         if (result.count("AT-Content"))
-            std::cout << std::setw(7) << std::left << "%AT";
+            out << std::setw(7) << std::left << "%AT";
         if (result.count("GC-Content"))
-            std::cout << std::setw(7) << std::left << "%GC";
-        std::cout << "File\n";
+            out << std::setw(7) << std::left << "%GC";
+        if (result.count("CpG"))
+            out << std::setw(8) << std::left << "CpG-o/e";
+        if (result.count("quality"))
+            out << std::setw(7) << std::left << "MeanQ"
+                << std::setw(7) << std::left << "%Q20"
+                << std::setw(7) << std::left << "%Q30";
+        if (!checksum.empty())
+            out << std::setw(17) << std::left << "Unordered"
+                << std::setw(17) << std::left << "Ordered";
+        out << "File\n";
 
         // making file list
         std::vector<std::string> file_stdin{ "-" };
@@ -129,102 +549,357 @@ int main(int argc, char* argv[])
         if (result.count("files-from"))
         {
             auto& file = result["files-from"].as<std::string>();
-            gzFile fp = file == "-"
-            ?   gzdopen(fileno(stdin), "r")
-            :   gzopen(file.c_str(), "r");
+            amstools::instream* fp = amstools::in_open(file);
             if (nullptr == fp)
-                std::cerr << options.program() << ": "
-                            << "error reading "
-                            << file
-                            << std::endl;
+            {
+                err << options.program() << ": "
+                      << "error reading "
+                      << file
+                      << std::endl;
+                return 1;
+            }
             kstream_t* ks = ks_init(fp);
             kstring_t str = {0,0,0};
             while (ks_getuntil(ks, '\n', &str, 0) >= 0)
                 files_from.emplace_back(str.s);
             ks_destroy(ks);
-            gzclose(fp);
+            amstools::in_close(fp);
             free(str.s);
         }
 
         auto& files = result.count("files-from") ? files_from : files_in;
 
-        for (const auto& file : files)
+        // k-mer spectra are printed after the residue statistics of all files
+        std::vector<kmer_counter> spectra;
+        std::vector<std::string> spectra_files;
+        if (k)
+            spectra.reserve(files.size());
+
+        // so are the quality profiles
+        std::vector<std::vector<double>> profiles;
+        std::vector<std::string> profiles_files;
+
+        // statistics of each FILE, made by the thread reading it once done
+        struct file_stats
+        {
+            bool invalid;           // with --validate
+            std::string row;
+            std::string errors;
+            std::unique_ptr<kmer_counter> spectrum;
+            std::vector<double> profile;
+        };
+        std::vector<file_stats> stats(files.size());
+
+        auto read_file = [&](size_t index)
         {
+            const auto& file = files[index];
+            auto& fs = stats[index];
             size_t seqsn{}, bpsn{};
-            gzFile fp = file == "-"
-            ?   gzdopen(fileno(stdin), "r")
-            :   gzopen(file.c_str(), "r");
-            if (nullptr == fp)
+            const bool twobit = !selected && file != "-" && amstools::is_twobit(file);
+            amstools::instream* fp = nullptr;
+            if (!twobit && !selected)
             {
-                std::cerr << options.program() << ": "
-                            << "error reading:\t"
-                            << file
-                            << std::endl;
-                continue;
+                fp = amstools::in_open(file);
+                if (nullptr == fp)
+                {
+                    fs.errors
+                    =   options.program() + ": error reading:\t" + file + '\n';
+                    return;
+                }
             }
-            kseq_t* seq = kseq_init(fp);
             std::unordered_map<char, size_t> bp_counter(7);
-            while (kseq_read(seq) >= 0)
+            if (k)
+                fs.spectrum.reset
+                (   new kmer_counter(k, result.count("canonical") > 0)   );
+            kmer_counter* kmers = fs.spectrum.get();
+            kmer_counter dinucleotides(2, false);
+            kmer_counter* cpg = result.count("CpG")
+            ?   (k == 2 ? kmers : &dinucleotides)
+            :   nullptr;
+            quality_counter quals(result.count("quality-profile") > 0);
+            amstools::checksum sum(whole);
+            auto add_record = [&]
+            (   const char* n, size_t nl
+            ,   const char* s, size_t sl
+            ,   const char* q, size_t ql
+            )
+            {
+                if (!checksum.empty())
+                    sum.add(sum.hash(n, nl, s, sl, q, ql));
+            };
+            auto count_record = [&]
+            (   const char* s
+            ,   size_t l
+            ,   const char* q
+            ,   size_t ql
+            )
             {
                 ++seqsn;
-                bpsn += seq->seq.l;
-                for (size_t i = 0; i < seq->seq.l; ++i)
-                    bp_counter[seq->seq.s[i]]++;
+                bpsn += l;
+                for (size_t i = 0; i < l; ++i)
+                    bp_counter[s[i]]++;
+                if (kmers)
+                    (*kmers)(s, l);
+                if (cpg && cpg != kmers)
+                    (*cpg)(s, l);
+                if (quality)
+                    quals(q, ql);
+            };
+            if (selected)
+            {
+                // only the selected bytes are read
+                amstools::indexed_file ix(file);
+                std::string s, q;
+                for (const auto& spec : regions)
+                {
+                    auto r = ix.resolve(spec);
+                    ix.fetch(r, s, quality || whole ? &q : nullptr);
+                    count_record(s.data(), s.size(), q.data(), q.size());
+                    add_record
+                    (   ix.name(r).data(), ix.name(r).size()
+                    ,   s.data(), s.size()
+                    ,   q.data(), q.size()
+                    );
+                }
+            }
+            else if (twobit)
+            {
+                // residues are counted with popcounts over the packed words
+                // and only k-mers and digests need the sequences decoded
+                amstools::twobit_file tb(file);
+                std::string s;
+                for (size_t i = 0; i < tb.size(); ++i)
+                {
+                    ++seqsn;
+                    bpsn += tb.length(i);
+                    auto c = tb.composition(i);
+                    for (int j = 0; j < 4; ++j)
+                    {
+                        bp_counter["TCAG"[j]] += c.upper[j];
+                        bp_counter["tcag"[j]] += c.lower[j];
+                    }
+                    bp_counter['N'] += c.n_upper;
+                    bp_counter['n'] += c.n_lower;
+                    if (kmers || cpg || !checksum.empty())
+                    {
+                        tb.sequence(i, s);
+                        if (kmers)
+                            (*kmers)(s.data(), s.size());
+                        if (cpg && cpg != kmers)
+                            (*cpg)(s.data(), s.size());
+                        add_record
+                        (   tb.name(i).data(), tb.name(i).size()
+                        ,   s.data(), s.size()
+                        ,   nullptr, 0
+                        );
+                    }
+                }
+            }
+            else
+            {
+                amstools::validator check;
+                if (validate)
+                    fp->check = &check;
+                kseq_t* seq = kseq_init(fp);
+                while (kseq_read(seq) >= 0)
+                {
+                    count_record
+                    (   seq->seq.s
+                    ,   seq->seq.l
+                    ,   seq->qual.s
+                    ,   seq->qual.l
+                    );
+                    add_record
+                    (   seq->name.s, seq->name.l
+                    ,   seq->seq.s, seq->seq.l
+                    ,   seq->qual.s, seq->qual.l
+                    );
+                }
+                kseq_destroy(seq);
+                amstools::in_close(fp);
+                if (validate)
+                {
+                    check.finish();
+                    std::ostringstream log;
+                    fs.invalid = !amstools::print_errors(log, "acgt", file, check);
+                    fs.errors = log.str();
+                }
             }
-            kseq_destroy(seq);
-            gzclose(fp);
+
+            // percentages of empty files are printed as zeros
+            auto percent = [](double n, double d)
+            {   return d > 0.0 ? n / d * 100 : 0.0;   };
+            const double acgt
+            =   double(bp_counter['A'])
+            +   double(bp_counter['T'])
+            +   double(bp_counter['G'])
+            +   double(bp_counter['C']);
 
             // printing values
-            std::cout << std::setw(10) << std::left << seqsn << ' '
-                      << std::setw(10) << std::left << bpsn << ' ';
+            std::ostringstream row;
+            row << std::setw(10) << std::left << seqsn << ' '
+                << std::setw(10) << std::left << bpsn << ' ';
             if ( result.count("residues")
             || (0 == result.count("GC-Content")
             &&  0 == result.count("AT-Content")
+            &&  0 == result.count("CpG")
+            &&  0 == result.count("quality")
             &&  0 == result.count("residues") ) )
             {
                 for (size_t i = 0; i < residues.size(); ++i)
-                    std::cout << std::setw(10) << std::left
-                              << bp_counter[residues[i]] << ' ';
+                    row << std::setw(10) << std::left
+                        << bp_counter[residues[i]] << ' ';
                 for (size_t i = 0; i < residues.size(); ++i)
-                    std::cout << std::fixed
-                              << std::setw(5)
-                              << std::setprecision(2)
-                              << double(bp_counter[residues[i]])/bpsn*100
-                              << "% "
+                    row << std::fixed
+                        << std::setw(5)
+                        << std::setprecision(2)
+                        << percent(bp_counter[residues[i]], bpsn)
+                        << "% "
                             ;
             }
             if (result.count("AT-Content"))
-                std::cout << std::fixed
-                          << std::setw(5)
-                          << std::setprecision(2)
-                          <<    (double(bp_counter['A'])
-                              +  double(bp_counter['T']))
-                              / (double(bp_counter['A'])
-                              +  double(bp_counter['T'])
-                              +  double(bp_counter['G'])
-                              +  double(bp_counter['C']))
-                              *  100
+                row << std::fixed
+                    << std::setw(5)
+                    << std::setprecision(2)
+                    <<    percent
+                                (   double(bp_counter['A'])
+                                +   double(bp_counter['T'])
+                                ,   acgt
+                                )
                           <<   "% "
                         ;
             if (result.count("GC-Content"))
-                std::cout << std::fixed
-                          << std::setw(5)
-                          << std::setprecision(2)
-                          <<    (double(bp_counter['G'])
-                              +  double(bp_counter['C']))
-                              / (double(bp_counter['A'])
-                              +  double(bp_counter['T'])
-                              +  double(bp_counter['G'])
-                              +  double(bp_counter['C']))
-                              *  100
+                row << std::fixed
+                    << std::setw(5)
+                    << std::setprecision(2)
+                    <<    percent
+                                (   double(bp_counter['G'])
+                                +   double(bp_counter['C'])
+                                ,   acgt
+                                )
                           <<   "% "
                         ;
-            std::cout << file << std::endl;
+            if (cpg)
+                row << std::fixed
+                    << std::setw(7)
+                    << std::setprecision(3)
+                    << cpg->cpg_oe()
+                    << ' '
+                        ;
+            const unsigned offset = quals.offset(phred);
+            if (result.count("quality"))
+                row << std::fixed
+                    << std::setprecision(2)
+                    << std::setw(6) << quals.mean(offset) << ' '
+                    << std::setw(6) << quals.percent(20, offset) << ' '
+                    << std::setw(6) << quals.percent(30, offset) << ' '
+                        ;
+            if (!checksum.empty())
+                row << amstools::to_hex(sum.unordered()) << ' '
+                    << amstools::to_hex(sum.ordered()) << ' ';
+            row << file << '\n';
+            fs.row = row.str();
+            if (result.count("quality-profile"))
+                fs.profile = quals.profile(offset);
+        };
+
+        // printing the rows in the order of the files
+        auto print_row = [&](size_t index)
+        {
+            auto& fs = stats[index];
+            err << fs.errors << std::flush;
+            if (fs.invalid)
+                valid = false;
+            if (fs.row.empty())
+                return;
+            out << fs.row << std::flush;
+            if (fs.spectrum)
+            {
+                spectra.push_back(std::move(*fs.spectrum));
+                spectra_files.push_back(files[index]);
+            }
+            if (result.count("quality-profile"))
+            {
+                profiles.push_back(std::move(fs.profile));
+                profiles_files.push_back(files[index]);
+            }
+            fs = file_stats{};
+        };
+
+        amstools::for_each_ordered
+        (   files.size()
+        ,   threads
+        ,   cpus
+        ,   read_file
+        ,   print_row
+        );
+
+        // printing k-mer spectra
+        if (k)
+        {
+            out << '\n'
+                << std::setw(10) << std::left << "#Kmer" << ' '
+                << std::setw(10) << std::left << "Count" << ' '
+                << std::setw(8)  << std::left << "%"
+                << "File\n";
+            const std::uint32_t n = std::uint32_t(1) << (2 * k);
+            for (size_t f = 0; f < spectra.size(); ++f)
+            {
+                const auto& kmers = spectra[f];
+                double total = double(kmers.total());
+                for (std::uint32_t code = 0; code < n; ++code)
+                {
+                    if (kmers.canonical() && !kmers.is_canonical(code))
+                        continue;
+                    out << std::setw(10) << std::left
+                        << kmers.kmer(code) << ' '
+                        << std::setw(10) << std::left
+                        << kmers.count(code) << ' '
+                        << std::fixed
+                        << std::setw(5)
+                        << std::setprecision(2)
+                        << (total > 0.0 ? kmers.count(code) / total * 100 : 0.0)
+                        << "%  "
+                        << spectra_files[f]
+                        << '\n';
+                }
+            }
+            out << std::flush;
         }
+
+        // printing quality profiles
+        if (result.count("quality-profile"))
+        {
+            out << '\n'
+                << std::setw(10) << std::left << "#Pos" << ' '
+                << std::setw(10) << std::left << "MeanQ" << ' '
+                << "File\n";
+            for (size_t f = 0; f < profiles.size(); ++f)
+                for (size_t pos = 0; pos < profiles[f].size(); ++pos)
+                    out << std::setw(10) << std::left << pos + 1 << ' '
+                        << std::fixed
+                        << std::setprecision(2)
+                        << std::setw(10) << std::left
+                        << profiles[f][pos] << ' '
+                        << profiles_files[f]
+                        << '\n';
+            out << std::flush;
+        }
+        if (!valid)
+            return 1;
     }
     catch(std::exception& e)
     {
-        std::cerr << "acgt: " << e.what() << std::endl;
+        err << "acgt: " << e.what() << std::endl;
         return 1;
     }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    // turning sync off before any standard i/o occurs
+    std::cout.sync_with_stdio(false);
+
+    return amstools::dispatch("acgt", argc, argv, run);
 }
@@ -0,0 +1,211 @@
+//
+// Copyright (C) 2022 Armin Sobhani <arminms@gmail.com>
+//
+// The MIT License
+//
+
+#include <iostream>
+#include <cstdio>
+#include <vector>
+#include <string>
+
+#include <zlib.h>
+#include <kseq.h>
+#include <cxxopts.hpp>
+#include <twobit.hpp>
+#include <instream.hpp>
+
+#include <version.hpp>
+
+KSEQ_INIT(amstools::instream*, amstools::in_read)
+
+int main(int argc, char* argv[])
+{
+    // turning sync off before any standard i/o occurs
+    std::cout.sync_with_stdio(false);
+
+    try
+    {
+        cxxopts::Options options("fa2bit", " (amstools) -- convert to 2bit\n");
+        options.custom_help(
+            "[OPTION]... -o F2BIT [FILE]...\n"
+            "  fa2bit [OPTION]... -o F2BIT --files-from=F\n\n"
+            "Convert the sequences of all FILEs into a single F2BIT file in "
+            "the UCSC .2bit\nformat. Both FastA and FastQ (optionally compressed) "
+            "files are supported. Residues\nother than ACGT are stored as N and "
+            "lowercase residues are kept as soft-masked\nregions. Qualities are "
+            "discarded.\n\nThe result can be used in place of the original FILEs "
+            "by acgt, ngx and sc.\n\nWith no FILE, or when FILE is -, read "
+            "standard input."
+        );
+        options.add_options()
+        (   "o,output"
+        ,   "write the 2bit file to F2BIT"
+        ,   cxxopts::value<std::string>()
+        ,   "F2BIT"
+        )
+        (   "f,files-from"
+        ,   "read input from the files specified by\n"
+            "  names separated by newlines in file F\n"
+            "  If F is - then read names from standard input"
+        ,   cxxopts::value<std::string>()
+        ,   "F"
+        )
+        (   "help"
+        ,   "display this help and exit"
+        )
+        (   "version"
+        ,   "output version information and exit"
+        )
+        (   "files"
+        ,   "files"
+        ,   cxxopts::value<std::vector<std::string>>()
+        )
+        ;
+
+        options.parse_positional({"files"});
+        options.positional_help("");
+
+        auto result = options.parse(argc, argv);
+
+        if (result.count("help"))
+        {
+            std::cout << options.program()
+                      << options.help()
+                      << std::endl;
+            return 0;
+        }
+
+        if (result.count("version"))
+        {
+            std::cout << options.program()
+                      << AMSTOOLS_VERSION
+                      << std::endl;
+            return 0;
+        }
+
+        if (0 == result.count("output"))
+        {
+            std::cerr << options.program() << ": "
+                      << "missing output file (-o F2BIT)"
+                      << std::endl;
+            return 1;
+        }
+
+        if (result.count("files") && result.count("files-from"))
+        {
+            std::cerr << options.program() << ": "
+                        << "file operands cannot be combined with --files-from"
+                        << std::endl;
+            return 1;
+        }
+
+        // making file list
+        std::vector<std::string> file_stdin{ "-" };
+        auto& files_in = result.count("files")
+        ?   result["files"].as<std::vector<std::string>>()
+        :   file_stdin;
+
+        std::vector<std::string> files_from;
+        if (result.count("files-from"))
+        {
+            auto& file = result["files-from"].as<std::string>();
+            amstools::instream* fp = amstools::in_open(file);
+            if (nullptr == fp)
+            {
+                std::cerr << options.program() << ": "
+                            << "error reading "
+                            << file
+                            << std::endl;
+                return 1;
+            }
+            kstream_t* ks = ks_init(fp);
+            kstring_t str = {0,0,0};
+            while (ks_getuntil(ks, '\n', &str, 0) >= 0)
+                files_from.emplace_back(str.s);
+            ks_destroy(ks);
+            amstools::in_close(fp);
+            free(str.s);
+        }
+
+        auto& files = result.count("files-from") ? files_from : files_in;
+
+        // packing all sequences in memory as the index precedes them
+        std::vector<std::string> names;
+        std::vector<amstools::twobit_record> records;
+        for (const auto& file : files)
+        {
+            amstools::instream* fp = amstools::in_open(file);
+            if (nullptr == fp)
+            {
+                std::cerr << options.program() << ": "
+                            << "error reading:\t"
+                            << file
+                            << std::endl;
+                continue;
+            }
+            kseq_t* seq = kseq_init(fp);
+            while (kseq_read(seq) >= 0)
+            {
+                if (seq->name.l > 255)
+                    throw std::runtime_error(
+                        "sequence name longer than 255 characters: "
+                    +   std::string(seq->name.s) );
+                if (seq->seq.l > 0xFFFFFFFFULL)
+                    throw std::runtime_error(
+                        "sequence longer than 4 Gbp: "
+                    +   std::string(seq->name.s) );
+                names.emplace_back(seq->name.s, seq->name.l);
+                records.emplace_back();
+                records.back().assign(seq->seq.s, seq->seq.l);
+            }
+            kseq_destroy(seq);
+            amstools::in_close(fp);
+        }
+
+        // version 1 uses 64-bit offsets when the file exceeds 4 GB
+        std::uint64_t index_size{}, data_size{};
+        for (size_t i = 0; i < records.size(); ++i)
+        {
+            index_size += 1 + names[i].size() + 4;
+            data_size += records[i].bytes();
+        }
+        std::uint32_t version = 16 + index_size + data_size > 0xFFFFFFFFULL
+        ?   1
+        :   0;
+        if (version)
+            index_size += 4 * records.size();
+
+        auto& output = result["output"].as<std::string>();
+        std::FILE* fp = std::fopen(output.c_str(), "wb");
+        if (nullptr == fp)
+            throw std::runtime_error("error writing " + output);
+        amstools::twobit_record::put(fp, amstools::twobit_signature);
+        amstools::twobit_record::put(fp, version);
+        amstools::twobit_record::put(fp, std::uint32_t(records.size()));
+        amstools::twobit_record::put(fp, std::uint32_t(0));
+        std::uint64_t offset = 16 + index_size;
+        for (size_t i = 0; i < records.size(); ++i)
+        {
+            if (EOF == std::fputc(int(names[i].size()), fp)
+            ||  std::fwrite(names[i].data(), 1, names[i].size(), fp)
+            !=  names[i].size())
+                throw std::runtime_error("error writing " + output);
+            if (version)
+                amstools::twobit_record::put(fp, offset);
+            else
+                amstools::twobit_record::put(fp, std::uint32_t(offset));
+            offset += records[i].bytes();
+        }
+        for (const auto& record : records)
+            record.write(fp);
+        const bool failed = std::ferror(fp) != 0;
+        if (std::fclose(fp) || failed)
+            throw std::runtime_error("error writing " + output);
+    }
+    catch(std::exception& e)
+    {
+        std::cerr << "fa2bit: " << e.what() << std::endl;
+        return 1;
+    }
+}
\ No newline at end of file
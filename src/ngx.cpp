@@ -6,23 +6,50 @@
 
 #include <iostream>
 #include <cstdio>
+#include <memory>
 #include <iomanip>
 #include <unordered_map>
 #include <numeric>
+#include <algorithm>
+#include <cmath>
+#include <sstream>
 
 #include <zlib.h>
 #include <kseq.h>
 #include <cxxopts.hpp>
+#include <twobit.hpp>
+#include <instream.hpp>
+#include <faidx.hpp>
+#include <server.hpp>
+#include <workers.hpp>
 
 #include <version.hpp>
 
-KSEQ_INIT(gzFile, gzread)
+KSEQ_INIT(amstools::instream*, amstools::in_read)
 
-int main(int argc, char* argv[])
+// sorts lengths from the longest to the shortest; when there are more
+// sequences than distinct possible lengths (e.g. reads) a counting sort is
+// used, which is linear in the number of sequences
+void sort_lengths(std::vector<size_t>& lengths)
 {
-    // turning sync off before any standard i/o occurs
-    std::cout.sync_with_stdio(false);
+    if (lengths.empty())
+        return;
+    size_t longest = *std::max_element(lengths.begin(), lengths.end());
+    if (longest < lengths.size())
+    {
+        std::vector<size_t> count(longest + 1);
+        for (auto length : lengths)
+            ++count[length];
+        auto it = lengths.begin();
+        for (size_t length = longest + 1; length-- > 0; )
+            it = std::fill_n(it, count[length], length);
+    }
+    else
+        std::sort(lengths.begin(), lengths.end(), std::greater<size_t>());
+}
 
+int run(int argc, char* argv[], std::ostream& out, std::ostream& err)
+{
     try
     {
         cxxopts::Options options("ngx", " (amstools) -- print contig statistics\n");
@@ -30,14 +57,54 @@ int main(int argc, char* argv[])
             "[OPTION]... [FILE]...\n"
             "  ngx [OPTION]... --files-from=F\n\n"
             "Print the contiguity statistics (e.g. N50, L50) for each FILE.\n"
-            "Both FastA and FastQ (optionally gzipped) files are supported.\n"
+            "FastA and FastQ (optionally compressed) files as well as 2bit files "
+            "are\nsupported.\n"
             "Print NG/LG variants if expected genome size is provided.\n\n"
             "With no FILE, or when FILE is -, read standard input.\n\n"
             "The options below may be used to select which statistics are "
             "printed,\nalways in the following order: #Seq, #Res, Min, Max,"
-            " N(G)x..., L(G)x..., File.\n"
+            " N(G)x..., L(G)x..., auN(G), File.\nThe N(G)x curve and the "
+            "length histogram, if requested, are printed after\nthem.\n\nWith --follow, FILE is followed "
+            "as it grows (e.g. FastQ files written by a\nrunning sequencer) "
+            "and updated statistics are printed every S seconds until\nit is "
+            "interrupted or stops growing for T seconds.\n\nWith --regions or "
+            "--regions-file, only the given sequences or regions\nof each FILE "
+            "are considered using its .fai index, built when missing.\n\n"
+            "With --validate, malformed records, invalid residues or qualities "
+            "and\ntruncated input are reported with the record number and the "
+            "offset of the\nerror in the decompressed FILE.\n\n"
+            "With --threads, several FILEs are read at a time, each by one "
+            "thread, and their\nrows added in order. --cpus pins these "
+            "threads, e.g. to the CPUs of one NUMA\nnode, whose memory then "
+            "holds their buffers.\n\n"
+            "With --serve, ngx stays resident and answers ngx --connect clients, "
+            "keeping\nthe statistics of FILEs that have not changed since.\n"
         );
         options.add_options()
+        (   "follow"
+        ,   "keep reading FILE as it grows"
+        )
+        (   "interval"
+        ,   "print updated statistics every S seconds\n"
+            "  when following"
+        ,   cxxopts::value<double>()
+        ->  default_value("10")
+        ,   "S"
+        )
+        (   "idle-timeout"
+        ,   "stop following when FILE has not grown for\n"
+            "  T seconds (0 means never)"
+        ,   cxxopts::value<double>()
+        ->  default_value("0")
+        ,   "T"
+        )
+        (   "a,auN"
+        ,   "print the area under the Nx curve (auN)"
+        )
+        (   "c,curve"
+        ,   "print the full N(G)x and L(G)x curves for\n"
+            "  x = 1..100"
+        )
         (   "g,genome-size"
         ,   "expected genome size\n"
             "  if G is provided then NGx/LGx values\n"
@@ -52,6 +119,13 @@ int main(int argc, char* argv[])
         ,   cxxopts::value<std::string>()
         ,   "F"
         )
+        (   "histogram"
+        ,   "print the length histogram using B\n"
+            "  log-spaced bins per decade"
+        ,   cxxopts::value<unsigned>()
+        ->  implicit_value("10")
+        ,   "B"
+        )
         (   "l,lx-values"
         ,   "print Lx along with Nx values"
         )
@@ -70,9 +144,55 @@ int main(int argc, char* argv[])
         ->  default_value("50")
         ,   "x..."
         )
+        (   "progress"
+        ,   "report bytes processed, MB/s, records/s\n"
+            "  and ETA on standard error"
+        )
+        (   "regions"
+        ,   "consider only the comma separated regions\n"
+            "  NAME, NAME:BEG or NAME:BEG-END in L"
+        ,   cxxopts::value<std::string>()
+        ,   "L"
+        )
+        (   "regions-file"
+        ,   "consider only the regions listed one per\n"
+            "  line in file F"
+        ,   cxxopts::value<std::string>()
+        ,   "F"
+        )
+        (   "validate"
+        ,   "check that FILEs are well-formed, reporting\n"
+            "  the first errors of each; the exit status\n"
+            "  is 1 if any is not"
+        )
+        (   "threads"
+        ,   "read up to N FILEs at a time (default: 1,\n"
+            "  or one per CPU of --cpus); 0 means one\n"
+            "  per CPU"
+        ,   cxxopts::value<unsigned>()
+        ,   "N"
+        )
+        (   "cpus"
+        ,   "pin the threads reading FILEs to the CPUs\n"
+            "  in LIST (e.g. 0-7,16-23)"
+        ,   cxxopts::value<std::string>()
+        ,   "LIST"
+        )
         (   "s,sequence-lengths"
         ,   "print sequence lengths statistics"
         )
+        (   "serve"
+        ,   "stay resident and answer the requests of\n"
+            "  --connect clients on the Unix domain\n"
+            "  socket SOCK"
+        ,   cxxopts::value<std::string>()
+        ,   "SOCK"
+        )
+        (   "connect"
+        ,   "run through the server listening on SOCK"
+        ,   cxxopts::value<std::string>()
+        ,   "SOCK"
+        )
         (   "help"
         ,   "display this help and exit"
         )
@@ -92,25 +212,92 @@ int main(int argc, char* argv[])
 
         if (result.count("help"))
         {
-            std::cout << options.program()
-                      << options.help()
-                      << std::endl;
+            out << options.program()
+                << options.help()
+                << std::endl;
             return 0;
         }
 
         if (result.count("version"))
         {
-            std::cout << options.program()
-                      << AMSTOOLS_VERSION
-                      << std::endl;
+            out << options.program()
+                << AMSTOOLS_VERSION
+                << std::endl;
             return 0;
         }
 
+        // following and progress report as they go, on the client only
+        if (result.count("follow") || result.count("progress"))
+            amstools::require_client();
+
         if (result.count("files") && result.count("files-from"))
         {
-            std::cerr << options.program() << ": "
-                        << "file operands cannot be combined with --files-from"
-                        << std::endl;
+            err << options.program() << ": "
+                  << "file operands cannot be combined with --files-from"
+                  << std::endl;
+            return 1;
+        }
+
+        if (result.count("follow"))
+        {
+            if (result.count("files") != 1
+            ||  result["files"].as<std::vector<std::string>>().size() != 1
+            ||  result["files"].as<std::vector<std::string>>()[0] == "-")
+            {
+                err << options.program() << ": "
+                      << "--follow requires exactly one FILE"
+                      << std::endl;
+                return 1;
+            }
+        }
+
+        std::vector<std::string> regions;
+        if (result.count("regions"))
+            regions = amstools::split_regions(result["regions"].as<std::string>());
+        if (result.count("regions-file"))
+        {
+            auto more = amstools::read_regions(result["regions-file"].as<std::string>());
+            regions.insert(regions.end(), more.begin(), more.end());
+        }
+        const bool selected = result.count("regions") || result.count("regions-file");
+        if (selected
+        &&  (   result.count("follow")
+            ||  (0 == result.count("files") && 0 == result.count("files-from")) ))
+        {
+            err << options.program() << ": "
+                  << "regions require indexable FILE operands"
+                  << std::endl;
+            return 1;
+        }
+        const bool validate = result.count("validate") > 0;
+        if (selected && validate)
+        {
+            err << options.program() << ": "
+                << "--validate reads whole FILEs and cannot be combined "
+                   "with regions"
+                << std::endl;
+            return 1;
+        }
+        bool valid = true;
+
+        std::vector<unsigned> cpus;
+        if (result.count("cpus"))
+        {
+            cpus = amstools::parse_cpus(result["cpus"].as<std::string>());
+            amstools::check_cpus(cpus);
+        }
+        const unsigned threads = amstools::thread_count
+        (   result.count("threads")
+            ?   result["threads"].as<unsigned>()
+            :   cpus.empty() ? 1 : 0
+        ,   cpus
+        );
+        if (threads > 1 && result.count("progress"))
+        {
+            err << options.program() << ": "
+                << "--progress reads one FILE at a time and cannot be "
+                   "combined with more threads"
+                << std::endl;
             return 1;
         }
 
@@ -124,20 +311,21 @@ int main(int argc, char* argv[])
         if (result.count("files-from"))
         {
             auto& file = result["files-from"].as<std::string>();
-            gzFile fp = file == "-"
-            ?   gzdopen(fileno(stdin), "r")
-            :   gzopen(file.c_str(), "r");
+            amstools::instream* fp = amstools::in_open(file);
             if (nullptr == fp)
-                std::cerr << options.program() << ": "
-                            << "Error reading "
-                            << file
-                            << std::endl;
+            {
+                err << options.program() << ": "
+                      << "Error reading "
+                      << file
+                      << std::endl;
+                return 1;
+            }
             kstream_t* ks = ks_init(fp);
             kstring_t str = {0,0,0};
             while (ks_getuntil(ks, '\n', &str, 0) >= 0)
                 files_from.emplace_back(str.s);
             ks_destroy(ks);
-            gzclose(fp);
+            amstools::in_close(fp);
             free(str.s);
         }
 
@@ -148,6 +336,7 @@ int main(int argc, char* argv[])
         size_t nc = 3 + threshold.size();
         nc += result.count("sequence-lengths") ? 2 : 0;
         nc += result.count("lx-values") ? threshold.size() : 0;
+        nc += result.count("auN") ? 1 : 0;
         std::vector<std::string> table;
         table.reserve( (files.size() + 1) * nc);
 
@@ -174,119 +363,410 @@ int main(int argc, char* argv[])
                 table.emplace_back(lg);
             }
         }
+        if (result.count("auN"))
+            table.emplace_back(result.count("genome-size") ? "auNG" : "auN");
         table.emplace_back("File");
 
-        for (const auto& file : files)
+        // the curves and histograms of all files go in long format tables
+        std::vector<std::string> curve_table;
+        if (result.count("curve"))
         {
-            std::vector<size_t> contig_length;
-
-            gzFile fp = file == "-"
-            ?   gzdopen(fileno(stdin), "r")
-            :   gzopen(file.c_str(), "r");
-            if (nullptr == fp)
+            curve_table.emplace_back("x");
+            curve_table.emplace_back(result.count("genome-size") ? "NGx" : "Nx");
+            curve_table.emplace_back(result.count("genome-size") ? "LGx" : "Lx");
+            curve_table.emplace_back("File");
+        }
+        std::vector<std::string> histogram_table;
+        unsigned bins{};
+        if (result.count("histogram"))
+        {
+            bins = result["histogram"].as<unsigned>();
+            if (0 == bins)
             {
-                std::cerr << options.program() << ": "
-                            << "Error reading "
-                            << file
-                            << std::endl;
-                continue;
+                err << options.program() << ": "
+                      << "number of histogram bins must be positive"
+                      << std::endl;
+                return 1;
             }
-            kseq_t* seq = kseq_init(fp);
-            std::unordered_map<char, size_t> bp_counter(7);
-            while (kseq_read(seq) >= 0)
-                contig_length.push_back(seq->seq.l);
-            kseq_destroy(seq);
-            gzclose(fp);
+            histogram_table.emplace_back("Min");
+            histogram_table.emplace_back("Max");
+            histogram_table.emplace_back("#Seq");
+            histogram_table.emplace_back("#Res");
+            histogram_table.emplace_back("File");
+        }
 
-            // 1. ordering contigs by their lengths from the longest to the
-            //    shortest
-            std::sort(
-                contig_length.begin()
-            ,   contig_length.end()
-            ,   std::greater<size_t>()
-            );
+        // printing a row while following; as later rows are not known yet, a
+        // minimum column width is used to keep them aligned
+        auto print_row = [&out](const std::vector<std::string>& row)
+        {
+            for (const auto& cell : row)
+                out << std::setw(std::max<size_t>(cell.length() + 2, 12))
+                    << std::left << cell;
+            out << std::endl;
+        };
 
+        // adding the statistics of contigs ordered by their lengths from the
+        // longest to the shortest to the tables; everything is derived from a
+        // single cumulative sweep over the lengths
+        auto add_row = [&]
+        (   const std::vector<size_t>& contig_length
+        ,   const std::string& file
+        ,   std::vector<std::string>& table
+        ,   std::vector<std::string>* curve
+        ,   std::vector<std::string>* histogram
+        )
+        {
             // 2. set the number of contigs and residues
             auto min_length = result["min"].as<size_t>();
             auto n_contigs = contig_length.size();
             if (min_length > 1)
-                for (size_t i = 0; i < contig_length.size(); ++i)
-                    if (contig_length[i] < min_length)
-                    {
-                        n_contigs = i;
-                        break;
-                    }
+                n_contigs = size_t(std::upper_bound(
+                    contig_length.begin()
+                ,   contig_length.end()
+                ,   min_length
+                ,   std::greater<size_t>() ) - contig_length.begin() );
             auto n_res = std::accumulate(
                 contig_length.begin()
             ,   contig_length.begin() + n_contigs
-            ,   0 );
+            ,   size_t{} );
 
             // 3. calculate the cutoff value by summing all contigs and
-            //    multiplying by the threshold percentage
-            std::vector<size_t> cutoff;
-            cutoff.reserve(threshold.size());
-            if (result.count("genome-size"))
-            {
-                auto genome_size = result["genome-size"].as<size_t>();
-                for (auto x : threshold)
-                    cutoff.push_back(genome_size * x / 100);
-            }
-            else
+            //    multiplying by the threshold percentage; thresholds are
+            //    visited in increasing order during the sweep
+            size_t total = result.count("genome-size")
+            ?   result["genome-size"].as<size_t>()
+            :   n_res;
+            std::vector<size_t> order(threshold.size());
+            std::iota(order.begin(), order.end(), size_t{});
+            std::sort(
+                order.begin()
+            ,   order.end()
+            ,   [&](size_t a, size_t b)
+                {   return threshold[a] < threshold[b];   }
+            );
+
+            // 4. compute LN(G)x values, the curve and auN in one sweep
+            std::vector<size_t> lgx_value(threshold.size());
+            std::vector<size_t> ngx_value(threshold.size());
+            std::vector<size_t> curve_n, curve_l;
+            if (curve)
             {
-                for (auto x : threshold)
-                    cutoff.push_back(n_res * x / 100);
+                curve_n.resize(100);
+                curve_l.resize(100);
             }
-
-            // 4. compute LN(G)x values
-            std::vector<size_t> lgx_value(cutoff.size());
-            std::vector<size_t> ngx_value(cutoff.size());
-            for (size_t i = 0; i < cutoff.size(); ++i)
+            double squares{};
+            size_t sum{}, t{}, x{1};
+            for (size_t j = 0; j < n_contigs; ++j)
             {
-                size_t sum{};
-                for (size_t j = 0; j < n_contigs; ++j)
+                const size_t length = contig_length[j];
+                sum += length;
+                squares += double(length) * double(length);
+                for (; t < order.size() && sum >= total * threshold[order[t]] / 100; ++t)
+                {
+                    ngx_value[order[t]] = length;
+                    lgx_value[order[t]] = j + 1;
+                }
+                for (; curve && x <= 100 && sum >= total * x / 100; ++x)
                 {
-                    lgx_value[i] = j + 1;
-                    ngx_value[i] = contig_length[j];
-                    sum += contig_length[j];
-                    if (sum >= cutoff[i])
-                        break;
+                    curve_n[x - 1] = length;
+                    curve_l[x - 1] = j + 1;
                 }
             }
+            // cutoffs beyond the total length get the last contig
+            for (; n_contigs && t < order.size(); ++t)
+            {
+                ngx_value[order[t]] = contig_length[n_contigs - 1];
+                lgx_value[order[t]] = n_contigs;
+            }
+            for (; curve && n_contigs && x <= 100; ++x)
+            {
+                curve_n[x - 1] = contig_length[n_contigs - 1];
+                curve_l[x - 1] = n_contigs;
+            }
 
             // adding values to the table
             table.emplace_back(std::to_string(n_contigs));
             table.emplace_back(std::to_string(n_res));
             if (result.count("sequence-lengths"))
             {
-                table.emplace_back(std::to_string(contig_length[n_contigs - 1]));
-                table.emplace_back(std::to_string(contig_length[0]));
+                table.emplace_back(std::to_string(
+                    n_contigs ? contig_length[n_contigs - 1] : 0));
+                table.emplace_back(std::to_string(
+                    n_contigs ? contig_length[0] : 0));
             }
             for (size_t i = 0; i < threshold.size(); ++i)
                 table.emplace_back(std::to_string(ngx_value[i]));
             if (result.count("lx-values"))
                 for (size_t i = 0; i < threshold.size(); ++i)
                     table.emplace_back(std::to_string(lgx_value[i]));
+            if (result.count("auN"))
+            {
+                std::ostringstream aun;
+                aun << std::fixed << std::setprecision(2)
+                    << (total ? squares / double(total) : 0.0);
+                table.emplace_back(aun.str());
+            }
             table.emplace_back(file);
-        }
 
-        // calculating column widths
-        std::vector<size_t> cw(nc);
-        for (size_t i = 0; i < files.size() + 1; ++i)
-            for (size_t j = 0; j < nc; ++j)
-                if (table[i * nc + j].length() + 2 > cw[j])
-                    cw[j] = table[i * nc + j].length() + 2;
+            if (curve)
+                for (size_t i = 0; n_contigs && i < 100; ++i)
+                {
+                    curve->emplace_back(std::to_string(i + 1));
+                    curve->emplace_back(std::to_string(curve_n[i]));
+                    curve->emplace_back(std::to_string(curve_l[i]));
+                    curve->emplace_back(file);
+                }
+
+            // log-spaced bins with lower edges of ceil(10^(i/B)); lengths are
+            // sorted, so bins are filled walking down from the longest
+            if (histogram && n_contigs)
+            {
+                auto edge = [&](int i)
+                {
+                    double e = std::pow(10.0, double(i) / bins);
+                    double r = std::round(e);
+                    return size_t(std::fabs(e - r) < 1e-9 * e ? r : std::ceil(e));
+                };
+                size_t shortest = contig_length[n_contigs - 1];
+                int i = -1;     // the bin of zero-length sequences
+                if (shortest)
+                {
+                    i = int(std::log10(double(shortest)) * bins);
+                    while (i > 0 && edge(i) > shortest)
+                        --i;
+                    while (edge(i + 1) <= shortest)
+                        ++i;
+                }
+                for (size_t j = n_contigs; j > 0; ++i)
+                {
+                    size_t lo = i < 0 ? 0 : edge(i);
+                    size_t hi = i < 0 ? 0 : edge(i + 1) - 1;
+                    if (hi < lo)
+                        continue;   // bins narrower than one residue
+                    size_t n{}, res{};
+                    for (; j > 0 && contig_length[j - 1] <= hi; --j)
+                    {
+                        ++n;
+                        res += contig_length[j - 1];
+                    }
+                    histogram->emplace_back(std::to_string(lo));
+                    histogram->emplace_back(std::to_string(hi));
+                    histogram->emplace_back(std::to_string(n));
+                    histogram->emplace_back(std::to_string(res));
+                    histogram->emplace_back(file);
+                }
+            }
+        };
+
+        std::unique_ptr<amstools::progress> meter;
+        if (result.count("progress"))
+            meter.reset(new amstools::progress(options.program(), files));
+        // rows of each FILE, made by the thread reading it once done
+        struct file_rows
+        {
+            bool printed, invalid;
+            std::vector<std::string> row, curve, histogram;
+            std::string errors;
+        };
+        std::vector<file_rows> rows(files.size());
+
+        auto read_file = [&](size_t index)
+        {
+            const auto& file = files[index];
+            auto& rs = rows[index];
+            std::vector<size_t> contig_length;
+            if (meter)
+                meter->start_file(index, [&] { return contig_length.size(); });
+
+            if (selected)
+            {
+                // lengths come straight from the index
+                amstools::indexed_file ix(file);
+                contig_length.reserve(regions.size());
+                for (const auto& spec : regions)
+                    contig_length.push_back(ix.resolve(spec).length());
+            }
+            else if (file != "-" && amstools::is_twobit(file))
+            {
+                // lengths come straight from the 2bit directory
+                amstools::twobit_file tb(file);
+                contig_length.reserve(tb.size());
+                for (size_t i = 0; i < tb.size(); ++i)
+                    contig_length.push_back(tb.length(i));
+            }
+            else
+            {
+                amstools::instream* fp = amstools::in_open(file);
+                if (nullptr == fp)
+                {
+                    rs.errors
+                    =   options.program() + ": Error reading " + file + '\n';
+                    return;
+                }
+
+                // while following, the lengths read so far are kept sorted by
+                // merging in the newly read ones at every report
+                size_t sorted{};
+                auto merge_sorted = [&]
+                {
+                    std::sort(
+                        contig_length.begin() + sorted
+                    ,   contig_length.end()
+                    ,   std::greater<size_t>()
+                    );
+                    std::inplace_merge(
+                        contig_length.begin()
+                    ,   contig_length.begin() + sorted
+                    ,   contig_length.end()
+                    ,   std::greater<size_t>()
+                    );
+                    sorted = contig_length.size();
+                };
+                if (result.count("follow"))
+                {
+                    print_row(table);
+                    fp->follow.reset(new amstools::follower
+                    (   file
+                    ,   result["interval"].as<double>()
+                    ,   result["idle-timeout"].as<double>()
+                    ,   [&]
+                        {
+                            merge_sorted();
+                            std::vector<std::string> row;
+                            add_row(contig_length, file, row, 0, 0);
+                            print_row(row);
+                        }
+                    ));
+                }
+                fp->meter = meter.get();
+                amstools::validator check;
+                if (validate)
+                    fp->check = &check;
+                kseq_t* seq = kseq_init(fp);
+                while (kseq_read(seq) >= 0)
+                    contig_length.push_back(seq->seq.l);
+                kseq_destroy(seq);
+                amstools::in_close(fp);
+                if (validate)
+                {
+                    check.finish();
+                    std::ostringstream log;
+                    rs.invalid = !amstools::print_errors
+                    (   log
+                    ,   options.program()
+                    ,   file
+                    ,   check
+                    );
+                    rs.errors = log.str();
+                }
+                if (result.count("follow"))
+                {
+                    merge_sorted();
+                    std::vector<std::string> row;
+                    add_row
+                    (   contig_length
+                    ,   file
+                    ,   row
+                    ,   result.count("curve") ? &rs.curve : nullptr
+                    ,   result.count("histogram") ? &rs.histogram : nullptr
+                    );
+                    rs.printed = true;
+                    print_row(row);
+                    return;
+                }
+            }
+            if (meter)
+                meter->finish_file(contig_length.size());
 
-        // printing the table
-        for (size_t i = 0; i < files.size() + 1; ++i)
+            // 1. ordering contigs by their lengths from the longest to the
+            //    shortest
+            sort_lengths(contig_length);
+
+            add_row
+            (   contig_length
+            ,   file
+            ,   rs.row
+            ,   result.count("curve") ? &rs.curve : nullptr
+            ,   result.count("histogram") ? &rs.histogram : nullptr
+            );
+        };
+
+        // adding the rows to the tables in the order of the files
+        auto add_rows = [&](size_t index)
         {
-            for (size_t j = 0; j < nc; ++j)
-                std::cout << std::setw(cw[j]) << std::left << table[i * nc + j];
-            std::cout << std::endl;
+            auto& rs = rows[index];
+            err << rs.errors << std::flush;
+            if (rs.invalid)
+                valid = false;
+            if (rs.printed)
+                table.clear();  // already printed
+            table.insert(table.end(), rs.row.begin(), rs.row.end());
+            curve_table.insert
+            (   curve_table.end()
+            ,   rs.curve.begin()
+            ,   rs.curve.end()
+            );
+            histogram_table.insert
+            (   histogram_table.end()
+            ,   rs.histogram.begin()
+            ,   rs.histogram.end()
+            );
+            rs = file_rows{};
+        };
+
+        amstools::for_each_ordered
+        (   files.size()
+        ,   threads
+        ,   cpus
+        ,   read_file
+        ,   add_rows
+        );
+
+        // printing a table of nc columns with the widths of the widest cells
+        auto print_table = [&out](const std::vector<std::string>& table, size_t nc)
+        {
+            // calculating column widths
+            std::vector<size_t> cw(nc);
+            for (size_t i = 0; i < table.size() / nc; ++i)
+                for (size_t j = 0; j < nc; ++j)
+                    if (table[i * nc + j].length() + 2 > cw[j])
+                        cw[j] = table[i * nc + j].length() + 2;
+
+            // printing the table
+            for (size_t i = 0; i < table.size() / nc; ++i)
+            {
+                for (size_t j = 0; j < nc; ++j)
+                    out << std::setw(cw[j]) << std::left << table[i * nc + j];
+                out << std::endl;
+            }
+        };
+
+        print_table(table, nc);
+        if (result.count("curve"))
+        {
+            out << std::endl;
+            print_table(curve_table, 4);
+        }
+        if (result.count("histogram"))
+        {
+            out << std::endl;
+            print_table(histogram_table, 5);
         }
+        if (!valid)
+            return 1;
     }
     catch (std::exception& e)
     {
-        std::cerr << "ngx: " << e.what() << std::endl;
+        err << "ngx: " << e.what() << std::endl;
         return 1;
     }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    // turning sync off before any standard i/o occurs
+    std::cout.sync_with_stdio(false);
+
+    return amstools::dispatch("ngx", argc, argv, run);
 }
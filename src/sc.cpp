@@ -5,21 +5,26 @@
 //
 
 #include <iostream>
+#include <sstream>
 #include <cstdio>
+#include <memory>
 
 #include <zlib.h>
 #include <kseq.h>
 #include <cxxopts.hpp>
+#include <twobit.hpp>
+#include <instream.hpp>
+#include <faidx.hpp>
+#include <server.hpp>
+#include <checksum.hpp>
+#include <workers.hpp>
 
 #include <version.hpp>
 
-KSEQ_INIT(gzFile, gzread)
+KSEQ_INIT(amstools::instream*, amstools::in_read)
 
-int main(int argc, char* argv[])
+int run(int argc, char* argv[], std::ostream& out, std::ostream& err)
 {
-    // turning sync off before any standard i/o occurs
-    std::cout.sync_with_stdio(false);
-
     try
     {
         cxxopts::Options options("sc", " (amstools) -- Sequence Count\n");
@@ -27,21 +32,84 @@ int main(int argc, char* argv[])
             "[OPTION]... [FILE]...\n"
             "  sc [OPTION]... --files-from=F\n\n"
             "Print seqs and bps counts for each FILE, and total values if more "
-            "than\none FILE is specified. Both FastA and FastQ (optionally "
-            "gzipped) files\nare supported.\n\nWith no FILE, or when FILE is -,"
+            "than\none FILE is specified. FastA and FastQ (optionally "
+            "compressed) files as well\nas 2bit files are supported.\n\nWith no FILE, or when FILE is -,"
             " read standard input.\n\nThe options below may be used to select "
             "which counts are printed, always in\nthe following order: seqs, "
-            "bps, maximum sequence length."
+            "bps, maximum sequence length.\n\nWith --follow, FILE is "
+            "followed as it grows (e.g. FastQ files written by a\nrunning "
+            "sequencer) and updated counts are printed every S seconds until "
+            "it is\ninterrupted or stops growing for T seconds.\n\nWith "
+            "--regions or --regions-file, only the given sequences or\nregions "
+            "of each FILE are counted using its .fai index, built when missing."
+            "\n\nWith --checksum, two digests of the records follow the counts: "
+            "the first stays\nthe same when the records are reordered, the "
+            "second does not. Neither depends\non the compression of FILE."
+            "\n\nWith --validate, malformed records, invalid residues or "
+            "qualities and truncated\ninput are reported with the record "
+            "number and the offset of the error in the\ndecompressed FILE."
+            "\n\nWith --threads, several FILEs are read at a time, each by "
+            "one thread, and\ntheir counts printed in order. --cpus pins these "
+            "threads, e.g. to the CPUs of\none NUMA node, whose memory then "
+            "holds their buffers."
+            "\n\nWith --serve, sc stays resident and answers sc --connect "
+            "clients, keeping\nthe counts of FILEs that have not changed since."
         );
         options.add_options()
         ("b,bps", "print the base pair counts")
         ("s,seqs", "print the sequence counts")
         ("m,max-seq-length", "print the longest sequence counts")
+        ("checksum"
+        ,   "also print order-independent and order-\n"
+            "  dependent digests of the sequences (W=seq)\n"
+            "  or of whole records (W=all)"
+        ,   cxxopts::value<std::string>()->implicit_value("seq"), "W" )
+        ("validate"
+        ,   "check that FILEs are well-formed, reporting\n"
+            "  the first errors of each; the exit status\n"
+            "  is 1 if any is not" )
+        ("threads"
+        ,   "read up to N FILEs at a time (default: 1,\n"
+            "  or one per CPU of --cpus); 0 means one\n"
+            "  per CPU"
+        ,   cxxopts::value<unsigned>(), "N" )
+        ("cpus"
+        ,   "pin the threads reading FILEs to the CPUs\n"
+            "  in LIST (e.g. 0-7,16-23)"
+        ,   cxxopts::value<std::string>(), "LIST" )
+        ("follow", "keep reading FILE as it grows")
+        ("progress"
+        ,   "report bytes processed, MB/s, records/s\n"
+            "  and ETA on standard error" )
+        ("interval"
+        ,   "print updated counts every S seconds\n"
+            "  when following (default: 10)"
+        ,   cxxopts::value<double>()->default_value("10"), "S" )
+        ("idle-timeout"
+        ,   "stop following when FILE has not grown for\n"
+            "  T seconds (default: 0, never)"
+        ,   cxxopts::value<double>()->default_value("0"), "T" )
+        ("regions"
+        ,   "count only the comma separated regions\n"
+            "  NAME, NAME:BEG or NAME:BEG-END in L"
+        ,   cxxopts::value<std::string>(), "L" )
+        ("regions-file"
+        ,   "count only the regions listed one per\n"
+            "  line in file F"
+        ,   cxxopts::value<std::string>(), "F" )
         ("f,files-from"
         ,   "read input from the files specified by\n"
             "  names separated by newlines in file F;\n"
             "  If F is - then read names from standard input"
         ,   cxxopts::value<std::string>(), "F" )
+        ("serve"
+        ,   "stay resident and answer the requests of\n"
+            "  --connect clients on the Unix domain\n"
+            "  socket SOCK"
+        ,   cxxopts::value<std::string>(), "SOCK" )
+        ("connect"
+        ,   "run through the server listening on SOCK"
+        ,   cxxopts::value<std::string>(), "SOCK" )
         ("help", "display this help and exit")
         ("version", "output version information and exit")
         ("files", "files", cxxopts::value<std::vector<std::string>>())
@@ -54,26 +122,137 @@ int main(int argc, char* argv[])
 
         if (result.count("help"))
         {
-            std::cout << options.program()
-                      << options.help()
-                      << std::endl;
+            out << options.program()
+                << options.help()
+                << std::endl;
             return 0 ;
         }
 
         if (result.count("version"))
         {
-            std::cout << options.program()
-                      << AMSTOOLS_VERSION
-                      << std::endl;
+            out << options.program()
+                << AMSTOOLS_VERSION
+                << std::endl;
             return 0 ;
         }
 
+        // following and progress report as they go, on the client only
+        if (result.count("follow") || result.count("progress"))
+            amstools::require_client();
+
+        std::string checksum;
+        if (result.count("checksum"))
+        {
+            checksum = result["checksum"].as<std::string>();
+            if (checksum != "seq" && checksum != "all")
+            {
+                err << "sc: --checksum must be seq or all" << std::endl;
+                return 1;
+            }
+        }
+        const bool whole = checksum == "all";
+
+        // printing the selected counts and digests followed by label
+        auto print_counts = [&result, &out, &checksum]
+        (   size_t seqsn
+        ,   size_t bpsn
+        ,   size_t seqmax
+        ,   const amstools::checksum& sum
+        ,   const std::string& label
+        )
+        {
+            if (0 == result.count("seqs")
+            &&  0 == result.count("bps")
+            &&  0 == result.count("max-seq-length") )
+            {
+                out << seqsn << '\t' << bpsn;
+                if (!checksum.empty())
+                    out << '\t' << amstools::to_hex(sum.unordered())
+                        << '\t' << amstools::to_hex(sum.ordered());
+                if (!label.empty())
+                    out << '\t' << label;
+                out << std::endl;
+            }
+            else
+            {
+                if (result.count("seqs"))
+                    out << seqsn << '\t';
+                if (result.count("bps"))
+                    out << bpsn << '\t';
+                if (result.count("max-seq-length"))
+                    out << seqmax << '\t';
+                if (!checksum.empty())
+                    out << amstools::to_hex(sum.unordered()) << '\t'
+                        << amstools::to_hex(sum.ordered()) << '\t';
+                out << label << std::endl;
+            }
+        };
+
+        if (result.count("follow"))
+        {
+            if (result.count("files") != 1
+            ||  result["files"].as<std::vector<std::string>>().size() != 1
+            ||  result["files"].as<std::vector<std::string>>()[0] == "-")
+            {
+                err << "sc: --follow requires exactly one FILE"
+                    << std::endl;
+                return 1;
+            }
+        }
+
+        std::vector<std::string> regions;
+        if (result.count("regions"))
+            regions = amstools::split_regions(result["regions"].as<std::string>());
+        if (result.count("regions-file"))
+        {
+            auto more = amstools::read_regions(result["regions-file"].as<std::string>());
+            regions.insert(regions.end(), more.begin(), more.end());
+        }
+        const bool selected = result.count("regions") || result.count("regions-file");
+        if (selected
+        &&  (   result.count("follow")
+            ||  (0 == result.count("files") && 0 == result.count("files-from")) ))
+        {
+            err << "sc: regions require indexable FILE operands"
+                << std::endl;
+            return 1;
+        }
+        const bool validate = result.count("validate") > 0;
+        if (selected && validate)
+        {
+            err << "sc: --validate reads whole FILEs and cannot be combined "
+                   "with regions"
+                << std::endl;
+            return 1;
+        }
+        bool valid = true;
+
+        std::vector<unsigned> cpus;
+        if (result.count("cpus"))
+        {
+            cpus = amstools::parse_cpus(result["cpus"].as<std::string>());
+            amstools::check_cpus(cpus);
+        }
+        const unsigned threads = amstools::thread_count
+        (   result.count("threads")
+            ?   result["threads"].as<unsigned>()
+            :   cpus.empty() ? 1 : 0
+        ,   cpus
+        );
+        if (threads > 1 && result.count("progress"))
+        {
+            err << "sc: --progress reads one FILE at a time and cannot be "
+                   "combined with more threads"
+                << std::endl;
+            return 1;
+        }
+
         if (result.count("files") || result.count("files-from"))
         {
             if (result.count("files") && result.count("files-from"))
             {
-                std::cerr << "sc: file operands cannot be combinded with --files-from"
-                          << std::endl;
+                err << "sc: file operands cannot be combinded with --files-from"
+                    << std::endl;
                 return 1;
             }
 
@@ -81,17 +260,18 @@ int main(int argc, char* argv[])
             if (result.count("files-from"))
             {
                 auto& file = result["files-from"].as<std::string>();
-                gzFile fp = file == "-"
-                ?   gzdopen(fileno(stdin), "r")
-                :   gzopen(file.c_str(), "r");
+                amstools::instream* fp = amstools::in_open(file);
                 if (nullptr == fp)
-                    std::cerr << "sc: error reading " << file << std::endl;
+                {
+                    err << "sc: error reading " << file << std::endl;
+                    return 1;
+                }
                 kstream_t* ks = ks_init(fp);
                 kstring_t str = {0,0,0};
                 while (ks_getuntil(ks, '\n', &str, 0) >= 0)
                     files_from.emplace_back(str.s);
                 ks_destroy(ks);
-                gzclose(fp);
+                amstools::in_close(fp);
                 free(str.s);
             }
 
@@ -99,74 +279,187 @@ int main(int argc, char* argv[])
             ?   result["files"].as<std::vector<std::string>>()
             :   files_from;
             size_t seqsn_total{}, bpsn_total{}, seqmax_total{};
-            for (const auto& file : files)
+            amstools::checksum sum_total(whole);
+            std::unique_ptr<amstools::progress> meter;
+            if (result.count("progress"))
+                meter.reset(new amstools::progress("sc", files));
+
+            // counts of each FILE, published by the thread reading it once
+            // done; its digests are appended to the total ones in order
+            struct file_counts
             {
+                bool read, invalid;
+                size_t seqsn, bpsn, seqmax;
+                amstools::checksum sum;
+                std::string errors;
+            };
+            std::vector<file_counts> counts(files.size());
+
+            auto count_file = [&](size_t index)
+            {
+                const auto& file = files[index];
                 size_t seqsn{}, bpsn{}, seqmax{};
-                gzFile fp = file == "-"
-                ?   gzdopen(fileno(stdin), "r")
-                :   gzopen(file.c_str(), "r");
-                if (nullptr == fp)
+                amstools::checksum sum(whole);
+                std::ostringstream log;
+                bool invalid = false;
+                auto add_record = [&]
+                (   const char* n, size_t nl
+                ,   const char* s, size_t sl
+                ,   const char* q, size_t ql
+                )
+                {   sum.add(sum.hash(n, nl, s, sl, q, ql));   };
+                if (meter)
+                    meter->start_file(index, [&] { return seqsn; });
+                if (selected)
                 {
-                    std::cerr << "error reading:\t\t" << file << std::endl;
-                    continue;
+                    // lengths come straight from the index, so residues are
+                    // only read for the digests
+                    amstools::indexed_file ix(file);
+                    std::string s, q;
+                    for (const auto& spec : regions)
+                    {
+                        auto r = ix.resolve(spec);
+                        ++seqsn;
+                        bpsn += r.length();
+                        if (r.length() > seqmax)
+                            seqmax = r.length();
+                        if (!checksum.empty())
+                        {
+                            const auto& n = ix.name(r);
+                            ix.fetch(r, s, whole ? &q : nullptr);
+                            add_record
+                            (   n.data(), n.size()
+                            ,   s.data(), s.size()
+                            ,   q.data(), q.size()
+                            );
+                        }
+                    }
                 }
-                kseq_t* seq = kseq_init(fp);
-                while (kseq_read(seq) >= 0)
+                else if (file != "-" && amstools::is_twobit(file))
                 {
-                    ++seqsn;
-                    bpsn += seq->seq.l;
-                    if (seq->seq.l > seqmax)
-                        seqmax = seq->seq.l;
+                    // lengths come straight from the 2bit directory
+                    amstools::twobit_file tb(file);
+                    std::string s;
+                    for (size_t i = 0; i < tb.size(); ++i)
+                    {
+                        ++seqsn;
+                        bpsn += tb.length(i);
+                        if (tb.length(i) > seqmax)
+                            seqmax = tb.length(i);
+                        if (!checksum.empty())
+                        {
+                            tb.sequence(i, s);
+                            add_record
+                            (   tb.name(i).data(), tb.name(i).size()
+                            ,   s.data(), s.size()
+                            ,   nullptr, 0
+                            );
+                        }
+                    }
                 }
-                seqsn_total += seqsn;
-                bpsn_total += bpsn;
-                if (seqmax > seqmax_total)
-                    seqmax_total = seqmax;
-                kseq_destroy(seq);
-                gzclose(fp);
-                if (0 == result.count("seqs")
-                &&  0 == result.count("bps")
-                &&  0 == result.count("max-seq-length") )
-                    std::cout << seqsn << '\t'
-                              << bpsn  << '\t'
-                              << file
-                              << std::endl;
                 else
                 {
-                    if (result.count("seqs"))
-                        std::cout << seqsn << '\t';
-                    if (result.count("bps"))
-                        std::cout << bpsn << '\t';
-                    if (result.count("max-seq-length"))
-                        std::cout << seqmax << '\t';
-                    std::cout << file << std::endl;
+                    amstools::instream* fp = amstools::in_open(file);
+                    if (nullptr == fp)
+                    {
+                        counts[index].errors
+                        =   "error reading:\t\t" + file + '\n';
+                        return;
+                    }
+                    if (result.count("follow"))
+                        fp->follow.reset(new amstools::follower
+                        (   file
+                        ,   result["interval"].as<double>()
+                        ,   result["idle-timeout"].as<double>()
+                        ,   [&]
+                            {
+                                print_counts(seqsn, bpsn, seqmax, sum, file);
+                            }
+                        ));
+                    fp->meter = meter.get();
+                    amstools::validator check;
+                    if (validate)
+                        fp->check = &check;
+                    kseq_t* seq = kseq_init(fp);
+                    while (kseq_read(seq) >= 0)
+                    {
+                        ++seqsn;
+                        bpsn += seq->seq.l;
+                        if (seq->seq.l > seqmax)
+                            seqmax = seq->seq.l;
+                        if (!checksum.empty())
+                            add_record
+                            (   seq->name.s, seq->name.l
+                            ,   seq->seq.s, seq->seq.l
+                            ,   seq->qual.s, seq->qual.l
+                            );
+                    }
+                    kseq_destroy(seq);
+                    amstools::in_close(fp);
+                    if (validate)
+                    {
+                        check.finish();
+                        invalid = !amstools::print_errors(log, "sc", file, check);
+                    }
                 }
-            }
-            if (files.size() > 1)
+                if (meter)
+                    meter->finish_file(seqsn);
+                counts[index] = file_counts
+                {   true
+                ,   invalid
+                ,   seqsn, bpsn, seqmax
+                ,   sum
+                ,   log.str()
+                };
+            };
+
+            auto print_file = [&](size_t index)
             {
-                if (0 == result.count("seqs")
-                &&  0 == result.count("bps")
-                &&  0 == result.count("max-seq-length") )
-                    std::cout << seqsn_total << '\t'
-                              << bpsn_total
-                              << "\ttotal"
-                              << std::endl;
-                else
-                {
-                    if (result.count("seqs"))
-                        std::cout << seqsn_total << '\t';
-                    if (result.count("bps"))
-                        std::cout << bpsn_total << '\t';
-                    if (result.count("max-seq-length"))
-                        std::cout << seqmax_total << '\t';
-                    std::cout << "total" << std::endl;
-                }
-            }
+                auto& c = counts[index];
+                err << c.errors << std::flush;
+                if (c.invalid)
+                    valid = false;
+                if (!c.read)
+                    return;
+                seqsn_total += c.seqsn;
+                bpsn_total += c.bpsn;
+                if (c.seqmax > seqmax_total)
+                    seqmax_total = c.seqmax;
+                sum_total.append(c.sum);
+                print_counts(c.seqsn, c.bpsn, c.seqmax, c.sum, files[index]);
+            };
+
+            amstools::for_each_ordered
+            (   files.size()
+            ,   threads
+            ,   cpus
+            ,   count_file
+            ,   print_file
+            );
+            if (files.size() > 1)
+                print_counts
+                (   seqsn_total
+                ,   bpsn_total
+                ,   seqmax_total
+                ,   sum_total
+                ,   "total"
+                );
         }
         else
         {
             size_t seqsn{}, bpsn{}, seqmax{};
-            gzFile fp = gzdopen(fileno(stdin), "r");
+            amstools::checksum sum(whole);
+            std::unique_ptr<amstools::progress> meter;
+            if (result.count("progress"))
+            {
+                meter.reset(new amstools::progress("sc", { "-" }));
+                meter->start_file(0, [&] { return seqsn; });
+            }
+            amstools::instream* fp = amstools::in_open("-");
+            fp->meter = meter.get();
+            amstools::validator check;
+            if (validate)
+                fp->check = &check;
             kseq_t *seq = kseq_init(fp);
             while (kseq_read(seq) >= 0)
             {
@@ -174,28 +467,39 @@ int main(int argc, char* argv[])
                 bpsn += seq->seq.l;
                 if (seq->seq.l > seqmax)
                     seqmax = seq->seq.l;
+                if (!checksum.empty())
+                    sum.add(sum.hash
+                    (   seq->name.s, seq->name.l
+                    ,   seq->seq.s, seq->seq.l
+                    ,   seq->qual.s, seq->qual.l
+                    ));
             }
             kseq_destroy(seq);
-            gzclose(fp);
-            if (0 == result.count("seqs")
-            &&  0 == result.count("bps")
-            &&  0 == result.count("max-seq-length") )
-                std::cout << seqsn << '\t' << bpsn << std::endl;
-            else
+            amstools::in_close(fp);
+            if (validate)
             {
-                if (result.count("seqs"))
-                    std::cout << seqsn << '\t';
-                if (result.count("bps"))
-                    std::cout << bpsn << '\t';
-                if (result.count("max-seq-length"))
-                    std::cout << seqmax << '\t';
-                std::cout << std::endl;
+                check.finish();
+                valid = amstools::print_errors(err, "sc", "-", check);
             }
+            if (meter)
+                meter->finish_file(seqsn);
+            print_counts(seqsn, bpsn, seqmax, sum, "");
         }
+        if (!valid)
+            return 1;
     }
     catch(std::exception& e)
     {
-        std::cerr << "sc: " << e.what() << std::endl;
+        err << "sc: " << e.what() << std::endl;
         return 1;
     }
-}
\ No newline at end of file
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    // turning sync off before any standard i/o occurs
+    std::cout.sync_with_stdio(false);
+
+    return amstools::dispatch("sc", argc, argv, run);
+}
@@ -0,0 +1,47 @@
+# Runs a command and compares its standard output with a golden file
+#
+#   cmake -DCMD=prog|arg... -DGOLDEN=file -DWORKDIR=dir -P compare.cmake
+#
+# The arguments of CMD are separated by '|' as ';' would be split by add_test.
+# With -DSTATUS=n the command must exit with status n instead of 0, and its
+# standard error is also compared with -DERRORS=file. With -DERRORS_MATCH=re
+# its standard error must match the regular expression re instead.
+
+string(REPLACE "|" ";" CMD "${CMD}")
+execute_process(
+  COMMAND ${CMD}
+  WORKING_DIRECTORY ${WORKDIR}
+  OUTPUT_VARIABLE actual
+  ERROR_VARIABLE errors
+  RESULT_VARIABLE status
+)
+if(NOT DEFINED STATUS)
+  set(STATUS 0)
+endif()
+if(NOT status EQUAL STATUS)
+  message(FATAL_ERROR "command exited with ${status}: ${CMD}\n${errors}")
+endif()
+if(DEFINED ERRORS_MATCH AND NOT errors MATCHES "${ERRORS_MATCH}")
+  message(FATAL_ERROR
+    "errors do not match ${ERRORS_MATCH}\n"
+    "--- actual\n${errors}"
+  )
+endif()
+if(DEFINED ERRORS)
+  file(READ ${ERRORS} expected_errors)
+  if(NOT errors STREQUAL expected_errors)
+    message(FATAL_ERROR
+      "errors differ from ${ERRORS}\n"
+      "--- expected\n${expected_errors}"
+      "--- actual\n${errors}"
+    )
+  endif()
+endif()
+file(READ ${GOLDEN} expected)
+if(NOT actual STREQUAL expected)
+  message(FATAL_ERROR
+    "output differs from ${GOLDEN}\n"
+    "--- expected\n${expected}"
+    "--- actual\n${actual}"
+  )
+endif()
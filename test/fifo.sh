@@ -0,0 +1,34 @@
+#!/bin/sh
+# Runs PROG with the remaining arguments, reading each FILE of WORKDIR through
+# a FIFO of the same name, and compares its output with GOLDEN; arguments
+# starting with - are passed as they are
+#
+#   sh fifo.sh PROG GOLDEN WORKDIR ARG...
+
+prog=$1
+golden=$2
+workdir="$(cd "$3" && pwd)" || exit 1
+shift 3
+
+dir=$(mktemp -d "${TMPDIR:-/tmp}/amstools-fifo.XXXXXX") || exit 1
+writers=
+trap 'kill $writers 2>/dev/null; rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+for arg in "$@"; do
+  case "$arg" in
+    -*) ;;
+    *)
+      mkfifo "$arg" || exit 1
+      cat "$workdir/$arg" > "$arg" &
+      writers="$writers $!"
+      ;;
+  esac
+done
+
+"$prog" "$@" > fifo.out || exit 1
+if ! cmp -s "$golden" fifo.out; then
+  echo "output read through FIFOs differs from $golden" >&2
+  diff "$golden" fifo.out >&2
+  exit 1
+fi
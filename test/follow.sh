@@ -0,0 +1,54 @@
+#!/bin/sh
+# Runs PROG --follow on a file to which SOURCE in WORKDIR is appended in
+# chunks, cutting records and compressed blocks, and checks that the last
+# counts printed once the file stops growing are those of a one-shot run on
+# the complete file
+#
+#   sh follow.sh PROG WORKDIR SOURCE ARG...
+
+prog=$1
+source="$(cd "$2" && pwd)/$3"
+name=$3
+shift 3
+[ -f "$source" ] || exit 1
+
+dir=$(mktemp -d "${TMPDIR:-/tmp}/amstools-follow.XXXXXX") || exit 1
+trap 'kill $follower 2>/dev/null; rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+# the first chunk is there when following starts, as with a sequencer
+chunk=16384
+size=$(wc -c < "$source")
+dd if="$source" of="$name" bs=$chunk count=1 2>/dev/null
+"$prog" --follow --interval=0.2 --idle-timeout=2 "$@" "$name" > follow.out &
+follower=$!
+i=1
+while [ $((i * chunk)) -lt "$size" ]; do
+  sleep 0.05
+  dd if="$source" bs=$chunk skip=$i count=1 2>/dev/null >> "$name"
+  i=$((i + 1))
+done
+
+if ! wait $follower; then
+  follower=
+  echo "following $name failed" >&2
+  exit 1
+fi
+follower=
+if ! cmp -s "$source" "$name"; then
+  echo "$name was not copied whole" >&2
+  exit 1
+fi
+
+# rows are aligned differently while following
+"$prog" "$@" "$name" > once.out || exit 1
+expected=$(tail -n 1 once.out | tr -s ' \t' ' ' | sed 's/ $//')
+actual=$(tail -n 1 follow.out | tr -s ' \t' ' ' | sed 's/ $//')
+if [ "$expected" != "$actual" ]; then
+  echo "last counts while following differ" >&2
+  echo "--- expected" >&2
+  echo "$expected" >&2
+  echo "--- actual" >&2
+  echo "$actual" >&2
+  exit 1
+fi
@@ -0,0 +1,350 @@
+//
+// Copyright (C) 2022 Armin Sobhani <arminms@gmail.com>
+//
+// The MIT License
+//
+
+// Generates the FastA/FastQ corpora used by the end-to-end tests. The output
+// only depends on the fixed seed, so golden values stay valid everywhere.
+//
+//   mkfixtures DIR             small corpora with edge cases
+//   mkfixtures --perf N DIR    N reads of 150 bp for the timing tests
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <stdexcept>
+#include <cstdint>
+#include <algorithm>
+
+#include <zlib.h>
+#if defined(AMSTOOLS_HAVE_ZSTD)
+#   include <zstd.h>
+#endif
+#if defined(AMSTOOLS_HAVE_BZIP2)
+#   include <bzlib.h>
+#endif
+#if defined(AMSTOOLS_HAVE_LZMA)
+#   include <lzma.h>
+#endif
+
+struct record
+{
+    std::string name, seq, qual;
+};
+
+class generator
+{
+public:
+    explicit generator(std::uint32_t seed)
+    :   rng_(seed)
+    {}
+
+    // uniform integer in [lo, hi] not depending on the standard library's
+    // distributions, which differ between implementations
+    size_t uniform(size_t lo, size_t hi)
+    {   return lo + rng_() % (hi - lo + 1);   }
+
+    std::string residues(size_t n, const std::string& alphabet)
+    {
+        std::string s(n, 'A');
+        for (auto& c : s)
+            c = alphabet[uniform(0, alphabet.size() - 1)];
+        return s;
+    }
+
+private:
+    std::mt19937 rng_;
+};
+
+std::string fasta(const std::vector<record>& records, size_t width, const char* eol)
+{
+    std::string out;
+    for (const auto& r : records)
+    {
+        out += '>' + r.name + eol;
+        for (size_t i = 0; i < r.seq.size(); i += width)
+            out += r.seq.substr(i, width) + eol;
+    }
+    return out;
+}
+
+std::string fastq(const std::vector<record>& records, const char* eol)
+{
+    std::string out;
+    for (const auto& r : records)
+        out += '@' + r.name + eol + r.seq + eol + '+' + eol + r.qual + eol;
+    return out;
+}
+
+void write(const std::string& path, const std::string& data)
+{
+    std::ofstream out(path, std::ios::binary);
+    out.write(data.data(), data.size());
+    if (!out)
+        throw std::runtime_error("error writing " + path);
+}
+
+void write_gz(const std::string& path, const std::string& data, int level)
+{
+    gzFile fp = gzopen(path.c_str(), ("wb" + std::to_string(level)).c_str());
+    if (nullptr == fp
+    ||  gzwrite(fp, data.data(), unsigned(data.size())) != int(data.size())
+    ||  gzclose(fp) != Z_OK )
+        throw std::runtime_error("error writing " + path);
+}
+
+// BGZF: a series of gzip members of at most 64 KiB each, with the block size
+// in a 'BC' extra field, followed by an empty end-of-file member
+void write_bgzf(const std::string& path, const std::string& data)
+{
+    std::ofstream out(path, std::ios::binary);
+    auto put16 = [&](unsigned v)
+    {
+        out.put(char(v & 0xFF));
+        out.put(char(v >> 8));
+    };
+    auto put32 = [&](unsigned long v)
+    {
+        put16(unsigned(v & 0xFFFF));
+        put16(unsigned(v >> 16));
+    };
+    const size_t block = 0xFF00;
+    std::vector<unsigned char> cdata(compressBound(block) + 64);
+    for (size_t first = 0; first <= data.size(); first += block)
+    {
+        size_t n = std::min(block, data.size() - first);
+        z_stream zs{};
+        deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+        zs.next_in = (Bytef*)(data.data() + first);
+        zs.avail_in = unsigned(n);
+        zs.next_out = cdata.data();
+        zs.avail_out = unsigned(cdata.size());
+        deflate(&zs, Z_FINISH);
+        size_t clen = zs.total_out;
+        deflateEnd(&zs);
+        const unsigned char header[] =
+        {   0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0   };
+        out.write((const char*)header, sizeof(header));
+        put16(unsigned(clen + 25));
+        out.write((const char*)cdata.data(), clen);
+        put32(crc32(crc32(0, Z_NULL, 0), (const Bytef*)data.data() + first, unsigned(n)));
+        put32((unsigned long)n);
+        if (n < block)
+            break;  // the last (possibly empty) block doubles as EOF marker
+    }
+    if (!out)
+        throw std::runtime_error("error writing " + path);
+}
+
+// little-endian integer appended to out
+void put_le(std::string& out, std::uint32_t v)
+{
+    for (int i = 0; i < 4; ++i)
+        out += char((v >> (8 * i)) & 0xFF);
+}
+
+#if defined(AMSTOOLS_HAVE_ZSTD)
+// seekable format: independent frames of 16 KiB followed by a skippable frame
+// holding the seek table
+void write_zstd(const std::string& path, const std::string& data)
+{
+    const size_t block = 1 << 14;
+    std::string out, table;
+    std::uint32_t frames = 0;
+    std::vector<char> cdata(ZSTD_compressBound(block));
+    for (size_t first = 0; first < data.size(); first += block, ++frames)
+    {
+        size_t n = std::min(block, data.size() - first);
+        size_t clen = ZSTD_compress(cdata.data(), cdata.size(), data.data() + first, n, 3);
+        if (ZSTD_isError(clen))
+            throw std::runtime_error("error compressing " + path);
+        out.append(cdata.data(), clen);
+        put_le(table, std::uint32_t(clen));
+        put_le(table, std::uint32_t(n));
+    }
+    put_le(table, frames);
+    table += '\0';
+    put_le(table, 0x8F92EAB1);
+    put_le(out, 0x184D2A5E);
+    put_le(out, std::uint32_t(table.size()));
+    write(path, out + table);
+}
+#endif
+
+#if defined(AMSTOOLS_HAVE_BZIP2)
+// two concatenated streams, as written by pbzip2
+void write_bzip2(const std::string& path, const std::string& data)
+{
+    std::string out;
+    size_t half = data.size() / 2;
+    for (auto part : { data.substr(0, half), data.substr(half) })
+    {
+        std::vector<char> cdata(part.size() + part.size() / 100 + 601);
+        unsigned clen = unsigned(cdata.size());
+        if (BZ2_bzBuffToBuffCompress
+            (cdata.data(), &clen, &part[0], unsigned(part.size()), 9, 0, 0) != BZ_OK)
+            throw std::runtime_error("error compressing " + path);
+        out.append(cdata.data(), clen);
+    }
+    write(path, out);
+}
+#endif
+
+#if defined(AMSTOOLS_HAVE_LZMA)
+// two concatenated streams
+void write_xz(const std::string& path, const std::string& data)
+{
+    std::string out;
+    size_t half = data.size() / 2;
+    for (auto part : { data.substr(0, half), data.substr(half) })
+    {
+        std::vector<std::uint8_t> cdata(lzma_stream_buffer_bound(part.size()));
+        size_t clen = 0;
+        if (lzma_easy_buffer_encode
+            (   6
+            ,   LZMA_CHECK_CRC64
+            ,   nullptr
+            ,   (const std::uint8_t*)part.data()
+            ,   part.size()
+            ,   cdata.data()
+            ,   &clen
+            ,   cdata.size() ) != LZMA_OK)
+            throw std::runtime_error("error compressing " + path);
+        out.append((const char*)cdata.data(), clen);
+    }
+    write(path, out);
+}
+#endif
+
+// a 2bit file whose only sequence, of 4 residues, has an N block running
+// past its end
+std::string badblock_twobit()
+{
+    std::string out;
+    auto put32 = [&](unsigned long v)
+    {
+        for (int i = 0; i < 4; ++i)
+            out += char((v >> 8 * i) & 0xFF);
+    };
+    put32(0x1A412743);  // signature
+    put32(0);           // version
+    put32(1);           // sequences
+    put32(0);           // reserved
+    out += '\1';
+    out += 'x';
+    put32(out.size() + 4);
+    put32(4);           // residues
+    put32(1);           // N blocks
+    put32(2);
+    put32(5);
+    put32(0);           // mask blocks
+    put32(0);           // reserved
+    out += '\x1B';      // TCAG
+    return out;
+}
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        generator gen(20220101);
+        if (argc == 4 && std::string(argv[1]) == "--perf")
+        {
+            std::string dir = argv[3];
+            size_t n = std::stoul(argv[2]);
+            std::vector<record> reads(n);
+            for (size_t i = 0; i < n; ++i)
+            {
+                reads[i].name = "read" + std::to_string(i);
+                reads[i].seq = gen.residues(150, "ACGT");
+                reads[i].qual = gen.residues(150, "#+5?IJ");
+            }
+            auto fq = fastq(reads, "\n");
+            write(dir + "/perf.fq", fq);
+            write_gz(dir + "/perf.fq.gz", fq, 1);
+            return 0;
+        }
+        if (argc != 2)
+        {
+            std::cerr << "usage: mkfixtures [--perf N] DIR" << std::endl;
+            return 1;
+        }
+        std::string dir = argv[1];
+
+        // contigs of various lengths, soft-masked and with Ns, wrapped at 60
+        const size_t lengths[] = { 1000, 61, 60, 0, 2500, 7, 350 };
+        std::vector<record> contigs;
+        for (auto l : lengths)
+        {
+            record r;
+            r.name = "contig" + std::to_string(contigs.size() + 1)
+                   + " length=" + std::to_string(l);
+            r.seq = gen.residues(l, "AAACCGGTTTacgtN");
+            contigs.push_back(r);
+        }
+        write(dir + "/empty.fa", "");
+        write(dir + "/wrapped.fa", fasta(contigs, 60, "\n"));
+        write(dir + "/crlf.fa", fasta(contigs, 60, "\r\n"));
+        write(dir + "/oneline.fa", fasta(contigs, size_t(-1), "\n"));
+
+        // reads of lengths 50..300 with qualities
+        std::vector<record> reads(1000);
+        for (size_t i = 0; i < reads.size(); ++i)
+        {
+            size_t l = gen.uniform(50, 300);
+            reads[i].name = "read" + std::to_string(i) + " sample=1";
+            reads[i].seq = gen.residues(l, "ACGTACGTACGTN");
+            reads[i].qual = gen.residues(l, "!#+5?@IJ");
+        }
+        auto fq = fastq(reads, "\n");
+        write(dir + "/reads.fq", fq);
+        write_gz(dir + "/reads.fq.gz", fq, 6);
+        write_bgzf(dir + "/reads.fq.bgz", fq);
+#if defined(AMSTOOLS_HAVE_ZSTD)
+        write_zstd(dir + "/reads.fq.zst", fq);
+#endif
+#if defined(AMSTOOLS_HAVE_BZIP2)
+        write_bzip2(dir + "/reads.fq.bz2", fq);
+#endif
+#if defined(AMSTOOLS_HAVE_LZMA)
+        write_xz(dir + "/reads.fq.xz", fq);
+#endif
+        write(dir + "/crlf.fq", fastq(reads, "\r\n"));
+
+        // reads with high qualities only (Q32-Q41), still Phred+33
+        std::vector<record> hq(100);
+        for (size_t i = 0; i < hq.size(); ++i)
+        {
+            hq[i].name = "hq" + std::to_string(i);
+            hq[i].seq = gen.residues(100, "ACGT");
+            hq[i].qual = gen.residues(100, "AEIJ");
+        }
+        write(dir + "/hq.fq", fastq(hq, "\n"));
+
+        // inputs failing --validate: an invalid residue, a '+' line not
+        // matching its header, an invalid quality, a quality longer than its
+        // sequence and a truncated last record; then compressed input cut
+        // short
+        write
+        (   dir + "/malformed.fq"
+        ,   "@r1\nACGT\n+\nIIII\n@r2\nAC#T\n+r2x\nII I\n"
+            "@r3\nACGTN\n+\nIIIIII\n@r4\nACG\n+\nIII\n@r5\nAC\n+\n"
+        );
+        write(dir + "/badblock.2bit", badblock_twobit());
+        std::ifstream gz(dir + "/reads.fq.gz", std::ios::binary);
+        std::string cut(20000, '\0');
+        gz.read(&cut[0], cut.size());
+        write(dir + "/truncated.fq.gz", cut);
+
+        write(dir + "/list.txt", "wrapped.fa\nreads.fq.gz\nempty.fa\n");
+        write(dir + "/regions.txt", "read1\nread5:10-20\nread7:20-\nread999:100-1000\n");
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "mkfixtures: " << e.what() << std::endl;
+        return 1;
+    }
+}
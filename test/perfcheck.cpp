@@ -0,0 +1,95 @@
+//
+// Copyright (C) 2022 Armin Sobhani <arminms@gmail.com>
+//
+// The MIT License
+//
+
+// Times a command and fails if its throughput in records/s regressed by more
+// than the tolerance relative to the baseline stored for the test name.
+//
+//   perfcheck NAME RECORDS BASELINE TOLERANCE COMMAND...
+//
+// The best of three runs is used. If AMSTOOLS_PERF_UPDATE is set in the
+// environment, or NAME is missing from BASELINE, the measured value is
+// written to BASELINE instead.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <map>
+#include <chrono>
+#include <cstdlib>
+
+int main(int argc, char* argv[])
+{
+    if (argc < 6)
+    {
+        std::cerr << "usage: perfcheck NAME RECORDS BASELINE TOLERANCE COMMAND..."
+                  << std::endl;
+        return 1;
+    }
+    std::string name = argv[1];
+    double records = std::stod(argv[2]);
+    std::string baseline_file = argv[3];
+    double tolerance = std::stod(argv[4]);
+
+    std::string command;
+    for (int i = 5; i < argc; ++i)
+        command += std::string(i > 5 ? " \"" : "\"") + argv[i] + '"';
+#if defined(_WIN32)
+    command += " > NUL";
+#else
+    command += " > /dev/null";
+#endif
+
+    double best{};
+    for (int run = 0; run < 3; ++run)
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (std::system(command.c_str()) != 0)
+        {
+            std::cerr << "perfcheck: command failed: " << command << std::endl;
+            return 1;
+        }
+        std::chrono::duration<double> elapsed
+        =   std::chrono::steady_clock::now() - start;
+        double rate = records / elapsed.count();
+        if (rate > best)
+            best = rate;
+    }
+
+    std::map<std::string, double> baseline;
+    {
+        std::ifstream in(baseline_file);
+        std::string line;
+        while (std::getline(in, line))
+        {
+            std::istringstream is(line);
+            std::string key;
+            double value;
+            if (line.size() && line[0] != '#' && is >> key >> value)
+                baseline[key] = value;
+        }
+    }
+
+    std::cout << name << ": " << std::fixed << best << " records/s";
+    auto it = baseline.find(name);
+    if (it == baseline.end() || std::getenv("AMSTOOLS_PERF_UPDATE"))
+    {
+        baseline[name] = best;
+        std::ofstream out(baseline_file);
+        out << "# records/s baselines of the timing tests\n";
+        for (const auto& b : baseline)
+            out << b.first << ' ' << std::fixed << b.second << '\n';
+        std::cout << " (baseline updated)" << std::endl;
+        return 0;
+    }
+    std::cout << ", baseline " << it->second << " records/s" << std::endl;
+    if (best < it->second * (1.0 - tolerance))
+    {
+        std::cerr << "perfcheck: " << name << " regressed by "
+                  << (1.0 - best / it->second) * 100 << "%" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+# Starts PROG as a server, runs it as a client twice with the remaining
+# arguments in WORKDIR, first computed and then from the cache, and compares
+# both outputs with GOLDEN
+#
+#   sh serve.sh PROG GOLDEN WORKDIR ARG...
+
+prog=$1
+golden=$2
+cd "$3" || exit 1
+shift 3
+
+sock="${TMPDIR:-/tmp}/amstools-test-$$.sock"
+"$prog" --serve="$sock" &
+server=$!
+trap 'kill $server 2>/dev/null; wait $server; rm -f "$sock.out"' EXIT
+
+tries=0
+while [ ! -S "$sock" ]; do
+  tries=$((tries + 1))
+  if [ $tries -gt 100 ]; then
+    echo "server did not start" >&2
+    exit 1
+  fi
+  sleep 0.1
+done
+
+for run in computed cached; do
+  "$prog" --connect="$sock" "$@" > "$sock.out" || exit 1
+  if ! cmp -s "$golden" "$sock.out"; then
+    echo "$run output differs from $golden" >&2
+    diff "$golden" "$sock.out" >&2
+    exit 1
+  fi
+done